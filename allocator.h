@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* -- Allocator -- */ 
 typedef void *(*alloc_fn)  (void *ctx, size_t size, size_t align);
@@ -23,16 +24,27 @@ static void *malloc_alloc(void *ctx, size_t size, size_t align)
 	(void)ctx;
 
 	if (align > 0)
-		assert(0 && "malloc does not support alignment");
+	{
+		assert((align & (align - 1)) == 0 && "align must be a power of two");
+		return (aligned_alloc(align, (size + align - 1) & ~(align - 1)));
+	}
 	return (malloc(size));
 }
 
 static void *malloc_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size, size_t align)
 {
-	(void)ctx;
-	(void)old_size;
-	(void)align;
-	return (realloc(ptr, new_size));
+	if (align == 0)
+		return (realloc(ptr, new_size));
+
+	void *new_ptr = malloc_alloc(ctx, new_size, align);
+	if (!new_ptr)
+		return (NULL);
+	if (ptr)
+	{
+		memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+		free(ptr);
+	}
+	return (new_ptr);
 }
 
 static void malloc_free(void *ctx, void *ptr)
@@ -2,7 +2,10 @@
    -----------------------------------------------------------------------------
    CIRCBUF.H v1.0.0
    -----------------------------------------------------------------------------
-   Lock-free SPSC/MPMC circular buffer with slot sequence numbers.
+   Lock-free SPSC/MPSC/SPMC/MPMC circular buffer with slot sequence numbers.
+   The concurrency mode is chosen per buffer (CircularBufferConfig.mode);
+   cb_init defaults to SPSC, or MPMC when CIRCBUF_MPMC is defined.
+   CircularByteBuffer is the SPSC variable-length (length-prefixed) variant.
    Memory-agnostic via Allocator pattern.
    
    Author:  Juuso Rinta
@@ -17,12 +20,18 @@
      #include "circbuf.h"
 
 	 In all other files, just #include "circbuf.h" as per normal.
+
+     The header leaves the includer's feature macros alone. On Linux the
+     implementation needs _DEFAULT_SOURCE (syscall(2) for futexes,
+     clock_gettime(2)): define it (or _GNU_SOURCE) above the first
+     #include in that file, or build with -D_DEFAULT_SOURCE.
 */
 
 
 #ifndef CIRCBUF_H
 # define CIRCBUF_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdatomic.h>
 #include <stdlib.h>
@@ -31,211 +40,1831 @@
 #include <errno.h>
 #include "allocator.h"
 
+#ifndef CIRCBUF_CACHE_LINE
+# define CIRCBUF_CACHE_LINE 64
+#endif
+
+#ifndef CIRCBUF_SLOT_ALIGN
+# define CIRCBUF_SLOT_ALIGN _Alignof(max_align_t)	// slot data and stride alignment
+#endif
+
+#ifndef CIRCBUF_BACKOFF_MAX_SHIFT
+# define CIRCBUF_BACKOFF_MAX_SHIFT 6	// CB_BACKOFF_EXP caps at 64 pauses
+#endif
+
+#ifndef CIRCBUF_WAIT_SPINS
+# define CIRCBUF_WAIT_SPINS  256	// busy polls before yielding
+#endif
+#ifndef CIRCBUF_WAIT_YIELDS
+# define CIRCBUF_WAIT_YIELDS 16		// sched_yield polls before sleeping
+#endif
+
+#ifndef CIRCBUF_FAA_SPINS
+# define CIRCBUF_FAA_SPINS 128		// CB_FLAG_FAA: polls for a claimed producer before skipping its slot
+#endif
+
+#ifndef CIRCBUF_STATS_SHARDS
+# define CIRCBUF_STATS_SHARDS 16	// CIRCBUF_STATS: counter shards per buffer
+#endif
+
+#ifdef CIRCBUF_MPMC
+# define CIRCBUF_DEFAULT_MODE CB_MPMC
+#else
+# define CIRCBUF_DEFAULT_MODE CB_SPSC
+#endif
+
 /* -- Types -- */
 
+/* Positions and slot sequence numbers. 32-bit by default; define
+   CIRCBUF_SEQ64 for 64-bit counters that never wrap in practice (and a
+   capacity no longer bounded by the signed 32-bit distance test). */
+#ifdef CIRCBUF_SEQ64
+typedef uint64_t	cb_seq_t;
+typedef int64_t		cb_sdiff_t;
+#else
+typedef uint32_t	cb_seq_t;
+typedef int32_t		cb_sdiff_t;
+#endif
+
+/* Concurrency mode, chosen per buffer. Bit 0 = multiple producers,
+   bit 1 = multiple consumers. */
+typedef enum {
+	CB_SPSC = 0,
+	CB_MPSC = 1,
+	CB_SPMC = 2,
+	CB_MPMC = 3,
+} CbMode;
+
+/* data is aligned to CIRCBUF_SLOT_ALIGN, and the stride rounded to match,
+   so every pointer the zero-copy API hands out can hold any object type. */
 typedef struct {
-	_Atomic uint32_t	seq;
-	uint8_t				data[];
+	_Atomic cb_seq_t						seq;
+	_Alignas(CIRCBUF_SLOT_ALIGN) uint8_t	data[];
 } Slot;
 
+/* Hot-path counters, compiled in with CIRCBUF_STATS. Slot counts, not
+   calls: a claim_n of 8 adds 8 to push_ok. cas_failures and stale_retries
+   come from the multi-thread sides of the seq protocol, high_water is the
+   largest head - tail seen right after a push claim. */
+typedef struct {
+	uint64_t	push_ok;
+	uint64_t	pop_ok;
+	uint64_t	push_full;
+	uint64_t	pop_empty;
+	uint64_t	cas_failures;
+	uint64_t	stale_retries;
+	uint64_t	high_water;
+} CbStats;
+
+#ifdef CIRCBUF_STATS
+/* Each thread writes only its own shard (picked once per thread,
+   round-robin) with plain relaxed load + store, so counting adds no
+   locked instructions and no shared lines. More threads than shards
+   may lose the odd increment to a collision. */
 typedef struct {
-	uint8_t							*slots;
+	_Alignas(64) _Atomic uint64_t	push_ok;
+	_Atomic uint64_t				pop_ok;
+	_Atomic uint64_t				push_full;
+	_Atomic uint64_t				pop_empty;
+	_Atomic uint64_t				cas_failures;
+	_Atomic uint64_t				stale_retries;
+	_Atomic uint64_t				high_water;
+} CbStatsShard;
+#endif
+
+typedef struct CircularBuffer CircularBuffer;
+
+/* Watermark callback: high = 1 when occupancy reached the high mark,
+   0 when it fell back to the low mark. Runs on the thread whose publish
+   (high) or release (low) noticed the crossing; it must not block on
+   this buffer. */
+typedef void	(*CbWatermarkFn)(CircularBuffer *cb, int high, void *ctx);
+
+/* The slot array is referenced by its offset from the struct itself, so
+   a CircularBuffer placed in shared memory next to its slots reads the
+   same in every process that maps it (see circbuf_shm.h). The other side
+   of that: a CircularBuffer must not be copied or moved once initialised.
+   alloc and the watermark callback stay process-local and are unused in
+   CB_FLAG_SHARED rings. */
+struct CircularBuffer {
+	intptr_t						slots_off;	// slot array - (uint8_t *)cb, 0 = none
 	uint32_t						slot_size;
 	uint32_t						stride;
 	uint32_t						mask;
+	uint32_t						swz_bits;	// 0 = linear index mapping
+	uint32_t						swz_mask;
+	uint32_t						mode;		// CbMode
+	uint32_t						flags;		// CB_FLAG_*
+	uint32_t						backoff;	// CbBackoff
+	uint32_t						wm_high;
+	uint32_t						wm_low;
+	uint32_t						wm_mask;	// check every wm_mask + 1 positions
+	uint32_t						pub_mask;	// SPSC: store head/tail every pub_mask + 1 positions
+	uint32_t						prefetch;	// pop claims prefetch this many positions ahead, 0 = off
+	CbWatermarkFn					on_watermark;	// NULL = no watermarks
+	void							*wm_ctx;
+	Allocator						alloc;
+	/* SPSC: head/tail are the published/released cursors; each side also
+	   keeps its own claim cursor and a cached copy of the opposite index,
+	   on its own cache line, so the shared index is only re-read when the
+	   cached bound says full/empty. Other modes: head/tail are the claim
+	   cursors of the seq protocol and the local fields are unused. */
+	_Alignas(64) _Atomic cb_seq_t	head;
+	cb_seq_t						head_claim;	// producer-local
+	cb_seq_t						head_pending;	// producer-local: published, head may lag
+	cb_seq_t						tail_cache;	// producer-local
+	_Alignas(64) _Atomic cb_seq_t	tail;
+	cb_seq_t						tail_claim;	// consumer-local
+	cb_seq_t						tail_pending;	// consumer-local: released, tail may lag
+	cb_seq_t						head_cache;	// consumer-local
+	/* Blocking layer: *_waiters count sleepers, the futex words are bumped
+	   on notify. Only written when someone actually sleeps. wm_state
+	   (1 = above the high mark) is only written on a watermark crossing. */
+	_Alignas(64) _Atomic uint32_t	push_waiters;
+	_Atomic uint32_t				not_full;
+	_Atomic uint32_t				pop_waiters;
+	_Atomic uint32_t				not_empty;
+	_Atomic uint32_t				wm_state;
+#ifdef CIRCBUF_STATS
+	CbStatsShard					stats[CIRCBUF_STATS_SHARDS];
+#endif
+};
+
+typedef enum {
+	CB_LAYOUT_PACKED = 0,	// slots back to back, 4-byte aligned (default)
+	CB_LAYOUT_PADDED,		// each slot padded to a cache line multiple
+	CB_LAYOUT_SWIZZLED,		// packed, but consecutive positions map to different lines
+} CbLayout;
+
+/* What a multi-producer/consumer side does after a failed CAS or a stale
+   seq before retrying. */
+typedef enum {
+	CB_BACKOFF_NONE = 0,	// retry immediately (default)
+	CB_BACKOFF_PAUSE,		// one CPU pause
+	CB_BACKOFF_EXP,			// 2^n pauses, n growing per retry up to CIRCBUF_BACKOFF_MAX_SHIFT
+	CB_BACKOFF_YIELD,		// sched_yield
+} CbBackoff;
+
+/* The slot array comes from a mirrored allocator (mirror_allocator.h):
+   a range that runs off the end continues linearly in the second mapping. */
+#define CB_FLAG_MIRRORED	1u
+/* The buffer lives in memory shared between processes: blocking waits
+   use process-shared futexes and watermark callbacks are not allowed. */
+#define CB_FLAG_SHARED		2u
+/* MPMC only: claim positions with fetch-and-add on head/tail instead of
+   a CAS loop, so contending threads never redo work. A claimed position
+   is always resolved, never retried: slot seq carries a per-lap state
+   (free, being written, full) and a consumer that overshoots an empty
+   ring, or outwaits a stalled producer, marks the slot skipped for that
+   lap; a producer that overshoots a full ring abandons its position for
+   the consumer to skip. Claims take one slot at a time (claim_n returns
+   at most 1), and skipped positions use up capacity until passed. */
+#define CB_FLAG_FAA			4u
+/* Single consumer only: the slots alone say which positions are
+   published, in every mode (SPSC publishes stamp seq too), so the ring
+   can be rebuilt with cb_recover from memory that outlived its process
+   (see circbuf_journal.h). */
+#define CB_FLAG_JOURNAL		8u
+/* SPSC only: run the per-slot seq protocol, with plain index stores on
+   both sides, instead of the cached cursors. Slower; it is what SPSC did
+   before the cursors and is kept as a benchmark baseline. */
+#define CB_FLAG_SLOT_SEQ	16u
+
+/* Watermarks are optional (on_watermark = NULL disables them). Producers
+   check for the high mark, consumers for the low mark, each only when a
+   publish/release crosses a multiple of watermark_interval (a power of
+   two, 0 = every position); low_watermark < high_watermark <= capacity.
+
+   publish_interval (SPSC only, a power of two <= capacity, 0 or 1 = off)
+   makes publishes and releases lazy: the producer stores head only when
+   a publish crosses a multiple of the interval, the consumer likewise for
+   tail, so small messages cost one shared store per interval instead of
+   one each. The other side sees up to interval - 1 messages (or free
+   slots) late. A side that finds the ring full/empty stores its own
+   cursor first, so two spinning sides never wait on each other; call
+   cb_push_flush before the producer goes idle (and cb_pop_flush before
+   the consumer does) so nothing is left unpublished. The blocking
+   variants always flush.
+
+   prefetch_distance (< capacity, 0 = off): every pop claim of count
+   slots from pos also prefetches the first line of slots pos + distance
+   up to pos + distance + count - 1, so each slot is requested distance
+   positions before it is claimed and the miss overlaps the consumer's
+   work on the messages in between. Choose it below the usual backlog: a
+   prefetched slot the producer has not written yet only moves its line
+   one extra time. */
+typedef struct {
+	uint32_t		capacity;
+	uint32_t		slot_size;
+	CbLayout		layout;
+	CbMode			mode;
+	uint32_t		flags;
+	CbBackoff		backoff;
+	uint32_t		high_watermark;
+	uint32_t		low_watermark;
+	uint32_t		watermark_interval;
+	uint32_t		publish_interval;
+	uint32_t		prefetch_distance;
+	CbWatermarkFn	on_watermark;
+	void			*watermark_ctx;
+} CircularBufferConfig;
+
+/* Variable-length SPSC ring: length-prefixed records stored back to back
+   in a byte array. head/tail are byte positions and play the role of the
+   slot seq numbers; a record that would straddle the end is preceded by
+   a padding record and starts again at offset 0, unless the buffer is
+   mirrored (CB_FLAG_MIRRORED), in which case it simply runs on into the
+   second mapping. */
+typedef struct {
+	uint32_t	size;	// payload bytes
+	uint32_t	flags;	// CBB_RECORD_PAD for padding records
+} ByteRecord;
+
+#define CBB_RECORD_PAD		1u
+#define CBB_RECORD_ALIGN	8u
+
+typedef struct {
+	uint8_t							*data;
+	uint32_t						mask;		// capacity - 1, in bytes
+	uint32_t						flags;		// CB_FLAG_MIRRORED: records never pad
 	Allocator						alloc;
-	_Alignas(64) _Atomic uint32_t	head;
-	_Alignas(64) _Atomic uint32_t	tail;
-} CircularBuffer;
+	_Alignas(64) _Atomic cb_seq_t	head;
+	cb_seq_t						head_claim;	// producer-local
+	cb_seq_t						tail_cache;	// producer-local
+	_Alignas(64) _Atomic cb_seq_t	tail;
+	cb_seq_t						tail_claim;	// consumer-local
+	cb_seq_t						head_cache;	// consumer-local
+} CircularByteBuffer;
 
 /* -- API -- */
 int	cb_init(CircularBuffer *cb, Allocator alloc, uint32_t capacity, uint32_t slot_size);
+int	cb_init_ex(CircularBuffer *cb, Allocator alloc, const CircularBufferConfig *cfg);
 void cb_free(CircularBuffer *cb);
 
-void *cb_push_claim(CircularBuffer *cb, uint32_t *out_pos);
-void cb_push_publish(CircularBuffer *cb, uint32_t pos);
+/* Bytes cb_init_ex will request from the allocator for cfg's slot array. */
+size_t cb_slots_size(const CircularBufferConfig *cfg);
+
+static inline size_t	cb_align_up(size_t val, size_t align) { return ((val + align - 1) & ~(align - 1)); }
+
+/* Allocator that hands out ctx, once: cb_init_ex over a slot area the
+   caller has already laid out (a shared segment, a block of lanes). */
+static inline void	*cb_place_alloc(void *ctx, size_t size, size_t align)
+{
+	(void)size;
+	(void)align;
+	return (ctx);
+}
+
+static inline Allocator	cb_place(void *at)
+{
+	Allocator a = { cb_place_alloc, NULL, NULL, at };
+
+	return (a);
+}
+
+static inline uint8_t	*cb_slots(const CircularBuffer *cb) { return ((uint8_t *)cb + cb->slots_off); }
+
+/* Index of the lowest set bit; v must be non-zero. */
+static inline uint32_t	cb_ctz64(uint64_t v)
+{
+	assert(v != 0 && "cb_ctz64 of 0");
+#if defined(__GNUC__)
+	return ((uint32_t)__builtin_ctzll(v));
+#else
+	uint32_t n = 0;
+
+	while (!(v & 1))
+	{
+		v >>= 1;
+		n++;
+	}
+	return (n);
+#endif
+}
+
+void *cb_push_claim(CircularBuffer *cb, cb_seq_t *out_pos);
+void cb_push_publish(CircularBuffer *cb, cb_seq_t pos);
+
+void *cb_pop_claim(CircularBuffer *cb, cb_seq_t *out_pos);
+void cb_pop_release(CircularBuffer *cb, cb_seq_t pos);
+
+/* Batch API: claims up to max contiguous positions with a single head/tail
+   update. Returns the number claimed (0 if full/empty), start in *out_pos.
+   Access each slot with cb_slot_data(cb, pos + i).
+   In SPSC mode publishes and releases must be issued in claim order. */
+uint32_t cb_push_claim_n(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos);
+void cb_push_publish_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count);
+
+uint32_t cb_pop_claim_n(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos);
+void cb_pop_release_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count);
+
+/* cb_pop_claim_n that also stores the address of each claimed slot in
+   slots[0..n), so the caller can walk them in a tight loop and hand the
+   whole range back with one cb_pop_release_n(cb, *out_pos, n). Claims
+   every contiguous ready slot up to max (one per call on CB_FLAG_FAA
+   rings). */
+uint32_t cb_pop_peek_n(CircularBuffer *cb, void **slots, uint32_t max, cb_seq_t *out_pos);
 
-void *cb_pop_claim(CircularBuffer *cb, uint32_t *out_pos);
-void cb_pop_release(CircularBuffer *cb, uint32_t pos);
+/* Hand back the last count slots of the most recent claim untouched, e.g.
+   when a read filled fewer slots than were claimed: pos + count must be
+   the end of that claim. Only for a side with a single thread (push:
+   SPSC/SPMC, pop: SPSC/MPSC); elsewhere later claims may already follow. */
+void cb_push_unclaim_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count);
+void cb_pop_unclaim_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count);
+
+/* Gives up count claimed slots from pos without publishing anything in
+   them: consumers step over them. With several producers, where later
+   claims may already follow, each slot is marked as a filler that is
+   free again for the next lap; with one producer this is
+   cb_push_unclaim_n and pos + count must end the last claim. */
+void cb_push_skip_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count);
+
+/* CB_FLAG_JOURNAL rings whose memory outlived the process that filled
+   them: rebuilds the cursors so the ring holds everything published from
+   tail on (up to the first slot claimed but never published), frees the
+   rest and clears the blocking state. Returns the number of positions
+   recovered, cb_push_skip_n fillers included. Nothing else may be using
+   the ring. */
+uint32_t cb_recover(CircularBuffer *cb, cb_seq_t tail);
+
+/* publish_interval rings: store the cursor up to everything published /
+   released so far. No-ops otherwise. Call from the producer / consumer
+   thread respectively. */
+void cb_push_flush(CircularBuffer *cb);
+void cb_pop_flush(CircularBuffer *cb);
+
+/* Occupancy from relaxed head/tail loads: exact when quiescent, otherwise
+   a snapshot that may be stale by the time it returns. Outside SPSC it
+   counts claimed rather than published/released slots. */
+uint32_t cb_size_approx(CircularBuffer *cb);
+
+void *cb_slot_data(CircularBuffer *cb, cb_seq_t pos);
+/* Returns slot pos and stores in *out_count how many of the next count
+   slots follow it linearly at cb->stride (all of them when mirrored). */
+void *cb_slot_span(CircularBuffer *cb, cb_seq_t pos, uint32_t count, uint32_t *out_count);
 
 int cb_push(CircularBuffer *cb, const void *data, uint32_t size);
 int cb_pop(CircularBuffer *cb, void *data, uint32_t size);
 
+/* Bulk copy: claims up to count slots in one go and copies records of
+   rec_size bytes (<= slot_size) between them and a packed array,
+   publishing/releasing the whole range at once. Returns the number of
+   records copied (0 if full/empty). CB_BULK_STREAM writes the
+   destination with non-temporal stores, for data that will not be read
+   again soon (SSE2 only, plain memcpy elsewhere). */
+#define CB_BULK_STREAM	1u
+
+uint32_t cb_push_bulk(CircularBuffer *cb, const void *src, uint32_t rec_size, uint32_t count, uint32_t flags);
+uint32_t cb_pop_bulk(CircularBuffer *cb, void *dst, uint32_t rec_size, uint32_t count, uint32_t flags);
+
+/* Blocking variants: spin, then yield, then sleep on a futex until the
+   operation succeeds or timeout_ns elapses (< 0 waits forever). Return 0,
+   or -ETIMEDOUT. Sleepers are only woken by the *_wait calls on the other
+   side, or by cb_notify_* after a claim/publish of your own. */
+int cb_push_wait(CircularBuffer *cb, const void *data, uint32_t size, int64_t timeout_ns);
+int cb_pop_wait(CircularBuffer *cb, void *data, uint32_t size, int64_t timeout_ns);
+
+void cb_notify_consumers(CircularBuffer *cb);
+void cb_notify_producers(CircularBuffer *cb);
+
+/* Nanoseconds on the monotonic clock the blocking layer times out on
+   (the C11 wall clock where there is none). */
+int64_t cb_now_ns(void);
+
+/* Sums the counter shards (CIRCBUF_STATS builds only). The snapshot is
+   not atomic across counters; reset while the buffer is in use may drop
+   concurrent increments. */
+#ifdef CIRCBUF_STATS
+void cb_stats_snapshot(CircularBuffer *cb, CbStats *out);
+void cb_stats_reset(CircularBuffer *cb);
+#endif
+
 #define cb_init_malloc(cb, capacity, slot_size) \
 	cb_init((cb), malloc_allocator(), (capacity), (slot_size))
 
+/* -- Variable-length API --
+   Capacity is in bytes. One outstanding claim per side: publish/release
+   before claiming the next record. */
+int	cbb_init(CircularByteBuffer *cbb, Allocator alloc, uint32_t capacity);
+int	cbb_init_ex(CircularByteBuffer *cbb, Allocator alloc, uint32_t capacity, uint32_t flags);
+void cbb_free(CircularByteBuffer *cbb);
+
+void *cbb_push_claim(CircularByteBuffer *cbb, uint32_t size, cb_seq_t *out_pos);
+void cbb_push_publish(CircularByteBuffer *cbb, cb_seq_t pos);
+/* Publish only the first size bytes of the claimed record (size <= the
+   claimed size), or drop the claim without publishing anything. */
+void cbb_push_publish_size(CircularByteBuffer *cbb, cb_seq_t pos, uint32_t size);
+void cbb_push_cancel(CircularByteBuffer *cbb, cb_seq_t pos);
+
+void *cbb_pop_claim(CircularByteBuffer *cbb, uint32_t *out_size, cb_seq_t *out_pos);
+void cbb_pop_release(CircularByteBuffer *cbb, cb_seq_t pos);
+/* Hand the claimed record back unreleased; the next claim returns it again. */
+void cbb_pop_unclaim(CircularByteBuffer *cbb, cb_seq_t pos);
+
+int cbb_push(CircularByteBuffer *cbb, const void *data, uint32_t size);
+int cbb_pop(CircularByteBuffer *cbb, void *data, uint32_t max_size, uint32_t *out_size);
+
+#define cbb_init_malloc(cbb, capacity) \
+	cbb_init((cbb), malloc_allocator(), (capacity))
+
 #endif // CIRCBUF_H
 
 #ifdef CIRCBUF_IMPLEMENTATION
 #ifndef CIRCBUF_IMPLEMENTATION_GUARD
 #define CIRCBUF_IMPLEMENTATION_GUARD
 
+#include <sched.h>
+#include <time.h>
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# if !defined(_DEFAULT_SOURCE) && !defined(_GNU_SOURCE) && !defined(_BSD_SOURCE)
+#  error "CIRCBUF_IMPLEMENTATION needs _DEFAULT_SOURCE defined before any system header"
+# endif
+#endif
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 #define ALIGN_UP(val, align) (((val) + (align) - 1) & ~((align) - 1))
 
+static inline void	cb_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
 static int	cb_is_power_of_two(uint32_t n) { return (n >= 2 && (n & (n - 1)) == 0); }
-static Slot	*cb_slot(CircularBuffer *cb, uint32_t pos) { return ((Slot *)(cb->slots + (pos & cb->mask) * cb->stride)); }
+
+/* Swizzled layout swaps the low swz_bits of the index with the next
+   swz_bits, so positions i and i+1 land 2^swz_bits slots (>= one cache
+   line) apart while the array stays densely packed. */
+static uint32_t	cb_index(CircularBuffer *cb, cb_seq_t pos)
+{
+	uint32_t idx = (uint32_t)(pos & cb->mask);
+
+	if (!cb->swz_bits)
+		return (idx);
+	uint32_t lo = idx & cb->swz_mask;
+	uint32_t mid = (idx >> cb->swz_bits) & cb->swz_mask;
+	return ((idx & ~(cb->swz_mask | (cb->swz_mask << cb->swz_bits))) | (lo << cb->swz_bits) | mid);
+}
+
+static Slot	*cb_slot(CircularBuffer *cb, cb_seq_t pos) { return ((Slot *)(cb_slots(cb) + (size_t)cb_index(cb, pos) * cb->stride)); }
+
+// SPSC rings take the cached-cursor paths unless CB_FLAG_SLOT_SEQ opts out
+static inline int	cb_cursors(const CircularBuffer *cb) { return (cb->mode == CB_SPSC && !(cb->flags & CB_FLAG_SLOT_SEQ)); }
+
+/* CB_FLAG_FAA positions must survive the << 2 below with a lap to
+   spare; any 32-bit capacity does with 64-bit positions. */
+#ifdef CIRCBUF_SEQ64
+# define CB_FAA_CAPACITY_OK(c)	1
+#else
+# define CB_FAA_CAPACITY_OK(c)	((c) <= ((cb_seq_t)-1 >> 4))
+#endif
+
+/* CB_FLAG_FAA slot states for the lap at position p. */
+#define CB_FAA_FREE(p)	((cb_seq_t)((p) << 2))
+#define CB_FAA_BUSY(p)	(CB_FAA_FREE(p) + 1)
+#define CB_FAA_FULL(p)	(CB_FAA_FREE(p) + 2)
+
+/* seq that publishes pos, and seq that frees its slot for the next lap. */
+static inline cb_seq_t	cb_seq_full(CircularBuffer *cb, cb_seq_t pos)
+{
+	return (cb->flags & CB_FLAG_FAA ? CB_FAA_FULL(pos) : pos + 1);
+}
+
+static inline cb_seq_t	cb_seq_freed(CircularBuffer *cb, cb_seq_t pos)
+{
+	return (cb->flags & CB_FLAG_FAA ? CB_FAA_FREE(pos + cb->mask + 1) : pos + cb->mask + 1);
+}
+
+#ifdef CIRCBUF_STATS
+static _Thread_local uint32_t	cb_stats_shard_id = UINT32_MAX;
+static _Atomic uint32_t			cb_stats_next_shard;
+
+static inline CbStatsShard	*cb_stats_shard(CircularBuffer *cb)
+{
+	if (cb_stats_shard_id == UINT32_MAX)
+		cb_stats_shard_id = atomic_fetch_add_explicit(&cb_stats_next_shard, 1,
+			memory_order_relaxed) % CIRCBUF_STATS_SHARDS;
+	return (&cb->stats[cb_stats_shard_id]);
+}
+
+static inline void	cb_stat_add(_Atomic uint64_t *counter, uint64_t n)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+		memory_order_relaxed);
+}
+
+static inline void	cb_stat_max(_Atomic uint64_t *counter, uint64_t v)
+{
+	if (v > atomic_load_explicit(counter, memory_order_relaxed))
+		atomic_store_explicit(counter, v, memory_order_relaxed);
+}
+
+# define CB_STAT(cb, field, n)	cb_stat_add(&cb_stats_shard(cb)->field, (n))
+# define CB_STAT_MAX(cb, field, v)	cb_stat_max(&cb_stats_shard(cb)->field, (v))
+#else
+# define CB_STAT(cb, field, n)	((void)0)
+# define CB_STAT_MAX(cb, field, v)	((void)0)
+#endif
 
 int			cb_init(CircularBuffer *cb, Allocator alloc, uint32_t capacity, uint32_t slot_size)
+{
+	CircularBufferConfig cfg = { .capacity = capacity, .slot_size = slot_size,
+		.layout = CB_LAYOUT_PACKED, .mode = CIRCBUF_DEFAULT_MODE };
+
+	return (cb_init_ex(cb, alloc, &cfg));
+}
+
+static uint32_t	cb_stride(const CircularBufferConfig *cfg)
+{
+	uint32_t stride = ALIGN_UP((uint32_t)sizeof(Slot) + cfg->slot_size, (uint32_t)_Alignof(Slot));
+
+	if (cfg->layout == CB_LAYOUT_PADDED)
+		stride = ALIGN_UP(stride, CIRCBUF_CACHE_LINE);
+	return (stride);
+}
+
+size_t		cb_slots_size(const CircularBufferConfig *cfg)
+{
+	assert(cfg != NULL && "cfg is NULL");
+	return ((size_t)cfg->capacity * cb_stride(cfg));
+}
+
+int			cb_init_ex(CircularBuffer *cb, Allocator alloc, const CircularBufferConfig *cfg)
 {
 	assert(cb != NULL && "cb is NULL");
+	assert(cfg != NULL && "cfg is NULL");
 	assert(alloc.alloc != NULL && "allocator must provide alloc function");
-	assert(cb_is_power_of_two(capacity) && "capacity must be a power of two");
-	assert(slot_size > 0 && "slot_size must be > 0");
+	assert(cb_is_power_of_two(cfg->capacity) && "capacity must be a power of two");
+	assert(cfg->slot_size > 0 && "slot_size must be > 0");
+	assert(cfg->mode <= CB_MPMC && "invalid mode");
+	assert(cfg->backoff <= CB_BACKOFF_YIELD && "invalid backoff");
+	assert(!((cfg->flags & CB_FLAG_MIRRORED) && cfg->layout == CB_LAYOUT_SWIZZLED)
+			&& "mirroring needs a linear layout");
+	assert((!cfg->on_watermark || (cfg->low_watermark < cfg->high_watermark
+			&& cfg->high_watermark <= cfg->capacity)) && "invalid watermarks");
+	assert((cfg->watermark_interval & (cfg->watermark_interval - 1)) == 0
+			&& "watermark_interval must be a power of two");
+	assert(!((cfg->flags & CB_FLAG_SHARED) && cfg->on_watermark)
+			&& "watermark callbacks cannot cross processes");
+	assert(!((cfg->flags & CB_FLAG_FAA) && (cfg->mode != CB_MPMC
+			|| !CB_FAA_CAPACITY_OK(cfg->capacity))) && "CB_FLAG_FAA needs MPMC and capacity < 2^(seq bits - 4)");
+	assert((cfg->publish_interval & (cfg->publish_interval - 1)) == 0 && cfg->publish_interval <= cfg->capacity
+			&& "publish_interval must be a power of two <= capacity");
+	assert((cfg->publish_interval <= 1 || cfg->mode == CB_SPSC) && "publish_interval needs SPSC");
+	assert(!((cfg->flags & CB_FLAG_JOURNAL) && (cfg->mode & CB_SPMC)) && "CB_FLAG_JOURNAL needs a single consumer");
+	assert(!((cfg->flags & CB_FLAG_SLOT_SEQ) && (cfg->mode != CB_SPSC || cfg->publish_interval > 1))
+			&& "CB_FLAG_SLOT_SEQ needs SPSC without publish_interval");
+	assert(cfg->prefetch_distance < cfg->capacity && "prefetch_distance must be < capacity");
 
-	if (!cb || !alloc.alloc || !cb_is_power_of_two(capacity) || slot_size == 0)
+	if (!cb || !cfg || !alloc.alloc || !cb_is_power_of_two(cfg->capacity) || cfg->slot_size == 0
+			|| cfg->mode > CB_MPMC || cfg->backoff > CB_BACKOFF_YIELD
+			|| ((cfg->flags & CB_FLAG_MIRRORED) && cfg->layout == CB_LAYOUT_SWIZZLED)
+			|| (cfg->on_watermark && (cfg->low_watermark >= cfg->high_watermark
+				|| cfg->high_watermark > cfg->capacity))
+			|| (cfg->watermark_interval & (cfg->watermark_interval - 1)) != 0
+			|| ((cfg->flags & CB_FLAG_SHARED) && cfg->on_watermark)
+			|| ((cfg->flags & CB_FLAG_FAA) && (cfg->mode != CB_MPMC
+				|| !CB_FAA_CAPACITY_OK(cfg->capacity)))
+			|| (cfg->publish_interval & (cfg->publish_interval - 1)) != 0
+			|| cfg->publish_interval > cfg->capacity
+			|| (cfg->publish_interval > 1 && cfg->mode != CB_SPSC)
+			|| ((cfg->flags & CB_FLAG_JOURNAL) && (cfg->mode & CB_SPMC))
+			|| ((cfg->flags & CB_FLAG_SLOT_SEQ) && (cfg->mode != CB_SPSC || cfg->publish_interval > 1))
+			|| cfg->prefetch_distance >= cfg->capacity)
 		return (-EINVAL);
 
-	cb->stride = ALIGN_UP(sizeof(Slot) + slot_size, _Alignof(Slot));
+	uint32_t capacity = cfg->capacity;
+
+	cb->stride = cb_stride(cfg);
+	cb->swz_bits = 0;
+	if (cfg->layout == CB_LAYOUT_SWIZZLED)
+	{
+		while ((cb->stride << cb->swz_bits) < CIRCBUF_CACHE_LINE
+				&& (4u << (2 * cb->swz_bits)) <= capacity)
+			++cb->swz_bits;
+	}
+	cb->swz_mask = (1u << cb->swz_bits) - 1;
+	cb->mode = cfg->mode;
+	cb->flags = cfg->flags;
+	cb->backoff = cfg->backoff;
+	cb->wm_high = cfg->high_watermark;
+	cb->wm_low = cfg->low_watermark;
+	cb->wm_mask = cfg->watermark_interval ? cfg->watermark_interval - 1 : 0;
+	cb->pub_mask = cfg->publish_interval ? cfg->publish_interval - 1 : 0;
+	cb->prefetch = cfg->prefetch_distance;
+	cb->on_watermark = cfg->on_watermark;
+	cb->wm_ctx = cfg->watermark_ctx;
 	cb->alloc = alloc;
-	cb->slot_size = slot_size;
+	cb->slot_size = cfg->slot_size;
 	cb->mask = capacity - 1;
-	cb->slots = alloc.alloc(alloc.ctx, capacity * cb->stride, 0);
+	uint8_t *slots = alloc.alloc(alloc.ctx, (size_t)capacity * cb->stride, CIRCBUF_CACHE_LINE);
 
-	if (!cb->slots)
+	if (!slots)
+	{
+		cb->slots_off = 0;
 		return (-ENOMEM);
+	}
+	cb->slots_off = (intptr_t)((uintptr_t)slots - (uintptr_t)cb);
 
 	for (uint32_t i = 0; i < capacity; ++i)
-		atomic_init(&((Slot *)(cb->slots + i * cb->stride))->seq, i);
+		atomic_init(&cb_slot(cb, i)->seq, cb->flags & CB_FLAG_FAA ? CB_FAA_FREE(i) : i);
 
 	atomic_init(&cb->head, 0);
 	atomic_init(&cb->tail, 0);
+	cb->head_claim = 0;
+	cb->head_pending = 0;
+	cb->tail_cache = 0;
+	cb->tail_claim = 0;
+	cb->tail_pending = 0;
+	cb->head_cache = 0;
+	atomic_init(&cb->push_waiters, 0);
+	atomic_init(&cb->not_full, 0);
+	atomic_init(&cb->pop_waiters, 0);
+	atomic_init(&cb->not_empty, 0);
+	atomic_init(&cb->wm_state, 0);
+#ifdef CIRCBUF_STATS
+	cb_stats_reset(cb);
+#endif
 	return (0);
 }
 
 void cb_free(CircularBuffer *cb)
 {
-	if (!cb || !cb->slots)
+	if (!cb || !cb->slots_off)
 		return;
 	if (cb->alloc.free)
-		cb->alloc.free(cb->alloc.ctx, cb->slots);
-	cb->slots = NULL;
+		cb->alloc.free(cb->alloc.ctx, cb_slots(cb));
+	cb->slots_off = 0;
 }
 
-void *cb_push_claim(CircularBuffer *cb, uint32_t *out_pos)
+/* -- Claim paths --
+   SPSC uses the cached-cursor path on both sides. Every other mode keeps
+   the per-slot seq protocol; a side with a single thread just stores its
+   index, a side with several threads CASes it. */
+
+/* Counts slots from pos with seq == pos + i + offset: free (offset 0)
+   or published (offset 1) for the current lap. */
+static inline uint32_t	cb_scan_ready(CircularBuffer *cb, cb_seq_t pos, uint32_t max, uint32_t offset)
 {
-	assert(cb != NULL && "cb is NULL");
-	assert(out_pos != NULL && "out_pos is NULL");
+	uint32_t n = 0;
 
-	uint32_t pos = atomic_load_explicit(&cb->head, memory_order_relaxed);
-	Slot *slot;
-#ifdef CIRCBUF_MPMC
+	while (n < max && atomic_load_explicit(&cb_slot(cb, pos + n)->seq,
+			memory_order_acquire) == pos + n + offset)
+		++n;
+	return (n);
+}
+
+static inline void	cb_backoff(CircularBuffer *cb, uint32_t *attempt)
+{
+	switch (cb->backoff)
+	{
+		case CB_BACKOFF_PAUSE:
+			cb_cpu_relax();
+			break;
+		case CB_BACKOFF_EXP:
+		{
+			uint32_t shift = *attempt < CIRCBUF_BACKOFF_MAX_SHIFT ? *attempt : CIRCBUF_BACKOFF_MAX_SHIFT;
+			for (uint32_t i = 0; i < (1u << shift); ++i)
+				cb_cpu_relax();
+			++*attempt;
+			break;
+		}
+		case CB_BACKOFF_YIELD:
+			sched_yield();
+			break;
+		default:
+			break;
+	}
+}
+
+static inline uint32_t	cb_seq_claim(CircularBuffer *cb, _Atomic cb_seq_t *index, uint32_t max,
+							uint32_t offset, int multi, cb_seq_t *out_pos)
+{
+	cb_seq_t pos = atomic_load_explicit(index, memory_order_relaxed);
+	uint32_t attempt = 0;
+	uint32_t n;
+
+	if (!multi)
+	{
+		while ((n = cb_scan_ready(cb, pos, max, offset)) == 0)
+		{
+			/* Only this thread moves the index, so a seq already past the
+			   published value can only be a cb_push_skip_n filler. */
+			if (offset == 0 || (cb_sdiff_t)(atomic_load_explicit(&cb_slot(cb, pos)->seq,
+					memory_order_acquire) - (pos + 1)) <= 0)
+				return (0); // Full/Empty
+			atomic_store_explicit(index, ++pos, memory_order_relaxed);
+		}
+		atomic_store_explicit(index, pos + n, memory_order_relaxed);
+		*out_pos = pos;
+		return (n);
+	}
 	for (;;)
 	{
-		slot = cb_slot(cb, pos);
-		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
-		int32_t	 diff = (int32_t)(seq - pos);
+		cb_seq_t   seq = atomic_load_explicit(&cb_slot(cb, pos)->seq, memory_order_acquire);
+		cb_sdiff_t diff = (cb_sdiff_t)(seq - (pos + offset));
 
 		if (diff == 0)
 		{
-			if (atomic_compare_exchange_weak_explicit(&cb->head, &pos, pos + 1,
+			n = cb_scan_ready(cb, pos, max, offset);
+			if (atomic_compare_exchange_weak_explicit(index, &pos, pos + n,
 					memory_order_relaxed, memory_order_relaxed))
 				break;
 			// else CAS failed, pos updated, retry
+			CB_STAT(cb, cas_failures, 1);
+			cb_backoff(cb, &attempt);
 		}
 		else if (diff < 0)
-			return (NULL); // Full
+			return (0); // Full/Empty
 		else
-			pos = atomic_load_explicit(&cb->head, memory_order_relaxed); // Retry
+		{
+			cb_seq_t now = atomic_load_explicit(index, memory_order_relaxed);
+
+			/* A consumer CASes tail past pos before its release moves seq
+			   past pos + 1, and the acquire above makes that CAS visible:
+			   seq ahead with tail still at pos is a cb_push_skip_n filler. */
+			if (offset == 1 && now == pos)
+			{
+				atomic_compare_exchange_weak_explicit(index, &now, pos + 1,
+					memory_order_relaxed, memory_order_relaxed);
+				pos = atomic_load_explicit(index, memory_order_relaxed);
+				continue;
+			}
+			CB_STAT(cb, stale_retries, 1);
+			cb_backoff(cb, &attempt);
+			pos = now; // Retry
+		}
 	}
-#else
-	slot = cb_slot(cb, pos);
-	uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
-	if (seq != pos)
-		return (NULL); // Full
-	atomic_store_explicit(&cb->head, pos + 1, memory_order_relaxed);
-#endif
 	*out_pos = pos;
-	return (slot->data);
+	return (n);
 }
 
-void cb_push_publish(CircularBuffer *cb, uint32_t pos)
+/* CB_FLAG_FAA engine. Every fetch-and-add hands the caller a position it
+   alone must resolve:
+     producer  FREE -> BUSY (CAS, racing only the one consumer of pos),
+               or give the position up: a consumer skipped it, or the
+               slot still holds an older lap nobody has claimed (full)
+     consumer  FULL -> read, or FREE -> FREE of the next lap (skip) once
+               no producer shows up within CIRCBUF_FAA_SPINS polls
+   Waits are only ever for a thread that already holds the position
+   ahead of us (a writer in BUSY, the older lap's consumer), so they are
+   short. head/tail are pre-checked so a full or empty ring rarely costs
+   a position at all. */
+static inline uint32_t	cb_faa_push_claim(CircularBuffer *cb, cb_seq_t *out_pos)
 {
-	assert(cb != NULL && "cb is NULL");
-	
-	Slot *slot = cb_slot(cb, pos);
-	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	uint32_t attempt = 0;
+
+	for (;;)
+	{
+		cb_seq_t tail = atomic_load_explicit(&cb->tail, memory_order_relaxed);
+		if ((cb_sdiff_t)(atomic_load_explicit(&cb->head, memory_order_relaxed) - tail) > (cb_sdiff_t)cb->mask)
+			return (0); // Full
+
+		cb_seq_t	pos = atomic_fetch_add_explicit(&cb->head, 1, memory_order_relaxed);
+		Slot		*slot = cb_slot(cb, pos);
+
+		for (;;)
+		{
+			cb_seq_t	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			cb_sdiff_t	diff = (cb_sdiff_t)(seq - CB_FAA_FREE(pos));
+
+			if (diff == 0)
+			{
+				if (atomic_compare_exchange_weak_explicit(&slot->seq, &seq, CB_FAA_BUSY(pos),
+						memory_order_acquire, memory_order_relaxed))
+				{
+					*out_pos = pos;
+					return (1);
+				}
+				CB_STAT(cb, cas_failures, 1);
+				continue;
+			}
+			if (diff > 0)
+				break; // Skipped by its consumer: take a new position
+			// An older lap: wait for its consumer if there is one yet
+			if ((cb_sdiff_t)(atomic_load_explicit(&cb->tail, memory_order_relaxed) - (pos - cb->mask)) < 0)
+				return (0); // Full; the consumer of pos will skip it
+			cb_backoff(cb, &attempt);
+		}
+		CB_STAT(cb, stale_retries, 1);
+	}
 }
 
-int	cb_push(CircularBuffer *cb, const void *data, uint32_t size)
+static inline uint32_t	cb_faa_pop_claim(CircularBuffer *cb, cb_seq_t *out_pos)
 {
-	assert(cb != NULL && "cb is NULL");
-	assert(data != NULL && "data is NULL");
-	assert(size <= cb->slot_size && "size exceeds slot_size");
-	if (!cb || !data || size > cb->slot_size)
-		return (-EINVAL);
+	uint32_t attempt = 0;
 
-	uint32_t pos;
-	void *slot_data = cb_push_claim(cb, &pos);
-	if (!slot_data)
-		return (-1); // Full
+	for (;;)
+	{
+		cb_seq_t tail = atomic_load_explicit(&cb->tail, memory_order_relaxed);
+		if ((cb_sdiff_t)(atomic_load_explicit(&cb->head, memory_order_relaxed) - tail) <= 0)
+			return (0); // Empty
 
-	memcpy(slot_data, data, size);
-	cb_push_publish(cb, pos);
+		cb_seq_t	pos = atomic_fetch_add_explicit(&cb->tail, 1, memory_order_relaxed);
+		Slot		*slot = cb_slot(cb, pos);
+		uint32_t	spins = 0;
 
-	return (0);
+		for (;;)
+		{
+			cb_seq_t	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			cb_sdiff_t	diff = (cb_sdiff_t)(seq - CB_FAA_FULL(pos));
+
+			if (diff == 0)
+			{
+				*out_pos = pos;
+				return (1);
+			}
+			if (diff > 0)
+				break; // Its producer gave it up (cb_push_skip_n)
+			if (diff == -2 && ((cb_sdiff_t)(atomic_load_explicit(&cb->head, memory_order_relaxed) - pos) <= 0
+					|| spins++ >= CIRCBUF_FAA_SPINS))
+			{
+				// No producer yet, or one that stalled or gave up: skip the lap
+				if (atomic_compare_exchange_strong_explicit(&slot->seq, &seq, CB_FAA_FREE(pos + cb->mask + 1),
+						memory_order_relaxed, memory_order_relaxed))
+					break;
+				CB_STAT(cb, cas_failures, 1);
+				continue;
+			}
+			cb_backoff(cb, &attempt); // BUSY, or an older lap still being consumed
+		}
+		CB_STAT(cb, stale_retries, 1);
+		if ((cb_sdiff_t)(atomic_load_explicit(&cb->head, memory_order_relaxed) - (pos + 1)) <= 0)
+			return (0); // Empty
+	}
 }
 
-void *cb_pop_claim(CircularBuffer *cb, uint32_t *out_pos)
+/* SPSC publish/release: moves a side's cursor to pos + count. With a
+   publish_interval the shared index is only stored when that crosses a
+   multiple of the interval; *pending always holds the real end. */
+static inline void	cb_spsc_advance(CircularBuffer *cb, _Atomic cb_seq_t *index, cb_seq_t *pending,
+						cb_seq_t pos, uint32_t count)
 {
-    assert(cb != NULL && "cb is NULL");
-    assert(out_pos != NULL && "out_pos is NULL");
-	
-	uint32_t	pos = atomic_load_explicit(&cb->tail, memory_order_relaxed);
-	Slot		*slot;
-#ifdef CIRCBUF_MPMC
-	for (;;)
+	if (count == 0)
+		return; // pos is not meaningful after an empty claim
+	*pending = pos + count;
+	if ((pos & ~(cb_seq_t)cb->pub_mask) != ((pos + count) & ~(cb_seq_t)cb->pub_mask))
+		atomic_store_explicit(index, pos + count, memory_order_release);
+}
+
+static inline void	cb_spsc_flush(_Atomic cb_seq_t *index, cb_seq_t pending)
+{
+	// Only the owning side stores index, so a relaxed load of it is exact
+	if (atomic_load_explicit(index, memory_order_relaxed) != pending)
+		atomic_store_explicit(index, pending, memory_order_release);
+}
+
+static inline uint32_t	cb_spsc_push_claim(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos)
+{
+	cb_seq_t pos = cb->head_claim;
+	uint32_t n = (uint32_t)(cb->mask + 1 - (pos - cb->tail_cache));
+
+	if (n < max)
 	{
-		slot = cb_slot(cb, pos);
-		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
-		int32_t  diff = (int32_t)(seq - (pos + 1));
+		cb->tail_cache = atomic_load_explicit(&cb->tail, memory_order_acquire);
+		n = (uint32_t)(cb->mask + 1 - (pos - cb->tail_cache));
+		if (n == 0)
+		{
+			if (cb->pub_mask)
+				cb_spsc_flush(&cb->head, cb->head_pending); // Let the consumer drain what we hold back
+			return (0); // Full
+		}
+	}
+	if (n > max)
+		n = max;
+	cb->head_claim = pos + n;
+	*out_pos = pos;
+	return (n);
+}
 
-		if (diff == 0)
+static inline uint32_t	cb_spsc_pop_claim(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos)
+{
+	cb_seq_t pos = cb->tail_claim;
+	uint32_t n = (uint32_t)(cb->head_cache - pos);
+
+	if (n < max)
+	{
+		cb->head_cache = atomic_load_explicit(&cb->head, memory_order_acquire);
+		n = (uint32_t)(cb->head_cache - pos);
+		if (n == 0)
 		{
-			if (atomic_compare_exchange_weak_explicit(&cb->tail, &pos, pos + 1,
-					memory_order_relaxed, memory_order_relaxed))
-				break;
+			if (cb->pub_mask)
+				cb_spsc_flush(&cb->tail, cb->tail_pending);
+			return (0); // Empty
 		}
-		else if (diff < 0)
-			return (NULL); // Empty
-		else
-			pos = atomic_load_explicit(&cb->tail, memory_order_relaxed);
+	}
+	if (n > max)
+		n = max;
+	cb->tail_claim = pos + n;
+	*out_pos = pos;
+	return (n);
+}
+
+static inline uint32_t	cb_push_claim_range(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos)
+{
+	uint32_t n;
+
+	if (cb_cursors(cb))
+		n = cb_spsc_push_claim(cb, max, out_pos);
+	else if (cb->flags & CB_FLAG_FAA)
+		n = cb_faa_push_claim(cb, out_pos);
+	else
+		n = cb_seq_claim(cb, &cb->head, max, 0, cb->mode & CB_MPSC, out_pos);
+	if (n == 0)
+		CB_STAT(cb, push_full, 1);
+	else
+	{
+		CB_STAT(cb, push_ok, n);
+		CB_STAT_MAX(cb, high_water, (uint64_t)(*out_pos + n
+			- atomic_load_explicit(&cb->tail, memory_order_relaxed)));
+	}
+	return (n);
+}
+
+/* Read-prefetches the first line of count slots from pos, once per line. */
+static inline void	cb_prefetch_slots(CircularBuffer *cb, cb_seq_t pos, uint32_t count)
+{
+#if defined(__GNUC__)
+	uintptr_t last = 0;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uintptr_t line = (uintptr_t)cb_slot(cb, pos + i) & ~(uintptr_t)(CIRCBUF_CACHE_LINE - 1);
+
+		if (line != last)
+			__builtin_prefetch((const void *)line, 0, 3);
+		last = line;
 	}
 #else
-	slot = cb_slot(cb, pos);
-	uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
-	if (seq != pos + 1)
-		return (NULL); // Empty
-	atomic_store_explicit(&cb->tail, pos + 1, memory_order_relaxed);
+	(void)cb;
+	(void)pos;
+	(void)count;
 #endif
-	*out_pos = pos;
-	return (slot->data);
 }
 
-void cb_pop_release(CircularBuffer *cb, uint32_t pos)
+static inline uint32_t	cb_pop_claim_range(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos)
 {
-	assert(cb != NULL && "cb is NULL");
+	uint32_t n;
 
-	Slot *slot = cb_slot(cb, pos);
-	atomic_store_explicit(&slot->seq, pos + cb->mask + 1, memory_order_release);
+	if (cb_cursors(cb))
+		n = cb_spsc_pop_claim(cb, max, out_pos);
+	else if (cb->flags & CB_FLAG_FAA)
+		n = cb_faa_pop_claim(cb, out_pos);
+	else
+		n = cb_seq_claim(cb, &cb->tail, max, 1, cb->mode & CB_SPMC, out_pos);
+	if (n == 0)
+		CB_STAT(cb, pop_empty, 1);
+	else
+	{
+		CB_STAT(cb, pop_ok, n);
+		if (cb->prefetch)
+			cb_prefetch_slots(cb, *out_pos + cb->prefetch, n);
+	}
+	return (n);
 }
 
-int cb_pop(CircularBuffer *cb, void *data, uint32_t size)
+/* -- Occupancy and watermarks -- */
+
+uint32_t cb_size_approx(CircularBuffer *cb)
 {
 	assert(cb != NULL && "cb is NULL");
-	assert(data != NULL && "data is NULL");
-	assert(size <= cb->slot_size && "size exceeds slot_size");
 
-	if (!cb || !data || size > cb->slot_size)
-		return (-EINVAL);
+	// tail first: head only moves forward, so head - tail cannot go negative
+	cb_seq_t tail = atomic_load_explicit(&cb->tail, memory_order_relaxed);
+	cb_seq_t head = atomic_load_explicit(&cb->head, memory_order_relaxed);
+	uint32_t size = (uint32_t)(head - tail);
 
-	uint32_t	pos;
-	void		*slot_data = cb_pop_claim(cb, &pos);
+	if ((cb_sdiff_t)(head - tail) < 0)
+		return (0); // CB_FLAG_FAA consumers overshoot an empty ring
+	return (size > cb->mask + 1 ? cb->mask + 1 : size);
+}
 
-	if (!slot_data)
-		return (-1); // Empty
+/* Called after a publish (high = 1) or release (high = 0) that moved the
+   cursor from pos to pos + count. Reads occupancy only when that range
+   crosses a multiple of the check interval, and writes wm_state only on
+   a transition, so the common case adds no loads of shared lines and no
+   stores at all. */
+static inline void	cb_watermark(CircularBuffer *cb, cb_seq_t pos, uint32_t count, int high)
+{
+	if (!cb->on_watermark || (pos & ~(cb_seq_t)cb->wm_mask) == ((pos + count) & ~(cb_seq_t)cb->wm_mask))
+		return;
 
-	memcpy(data, slot_data, size);
-	cb_pop_release(cb, pos);
+	uint32_t size = cb_size_approx(cb);
+	uint32_t state = atomic_load_explicit(&cb->wm_state, memory_order_relaxed);
+
+	if (high ? (state != 0 || size < cb->wm_high) : (state != 1 || size > cb->wm_low))
+		return;
+	if (atomic_compare_exchange_strong_explicit(&cb->wm_state, &state, (uint32_t)high,
+			memory_order_relaxed, memory_order_relaxed))
+		cb->on_watermark(cb, high, cb->wm_ctx);
+}
+
+/* -- Single-slot API -- */
+
+void *cb_push_claim(CircularBuffer *cb, cb_seq_t *out_pos)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+
+	if (!cb_push_claim_range(cb, 1, out_pos))
+		return (NULL); // Full
+	return (cb_slot(cb, *out_pos)->data);
+}
+
+void cb_push_publish(CircularBuffer *cb, cb_seq_t pos)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (cb_cursors(cb))
+	{
+		if (cb->flags & CB_FLAG_JOURNAL)
+			atomic_store_explicit(&cb_slot(cb, pos)->seq, pos + 1, memory_order_relaxed);
+		cb_spsc_advance(cb, &cb->head, &cb->head_pending, pos, 1);
+	}
+	else
+		atomic_store_explicit(&cb_slot(cb, pos)->seq, cb_seq_full(cb, pos), memory_order_release);
+	cb_watermark(cb, pos, 1, 1);
+}
+
+int	cb_push(CircularBuffer *cb, const void *data, uint32_t size)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(data != NULL && "data is NULL");
+	assert(size <= cb->slot_size && "size exceeds slot_size");
+	if (!cb || !data || size > cb->slot_size)
+		return (-EINVAL);
+
+	cb_seq_t pos;
+	void *slot_data = cb_push_claim(cb, &pos);
+	if (!slot_data)
+		return (-1); // Full
+
+	memcpy(slot_data, data, size);
+	cb_push_publish(cb, pos);
+
+	return (0);
+}
+
+void *cb_pop_claim(CircularBuffer *cb, cb_seq_t *out_pos)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+
+	if (!cb_pop_claim_range(cb, 1, out_pos))
+		return (NULL); // Empty
+	return (cb_slot(cb, *out_pos)->data);
+}
+
+void cb_pop_release(CircularBuffer *cb, cb_seq_t pos)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (cb_cursors(cb))
+		cb_spsc_advance(cb, &cb->tail, &cb->tail_pending, pos, 1);
+	else
+		atomic_store_explicit(&cb_slot(cb, pos)->seq, cb_seq_freed(cb, pos), memory_order_release);
+	cb_watermark(cb, pos, 1, 0);
+}
+
+int cb_pop(CircularBuffer *cb, void *data, uint32_t size)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(data != NULL && "data is NULL");
+	assert(size <= cb->slot_size && "size exceeds slot_size");
+
+	if (!cb || !data || size > cb->slot_size)
+		return (-EINVAL);
+
+	cb_seq_t	pos;
+	void		*slot_data = cb_pop_claim(cb, &pos);
+
+	if (!slot_data)
+		return (-1); // Empty
+
+	memcpy(data, slot_data, size);
+	cb_pop_release(cb, pos);
+	return (0);
+}
+
+/* -- Batch API -- */
+
+void *cb_slot_data(CircularBuffer *cb, cb_seq_t pos)
+{
+	assert(cb != NULL && "cb is NULL");
+	return (cb_slot(cb, pos)->data);
+}
+
+void *cb_slot_span(CircularBuffer *cb, cb_seq_t pos, uint32_t count, uint32_t *out_count)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(out_count != NULL && "out_count is NULL");
+
+	uint32_t to_end = cb->mask + 1 - (uint32_t)(pos & cb->mask);
+
+	if (cb->swz_bits)
+		*out_count = count ? 1 : 0;
+	else if (cb->flags & CB_FLAG_MIRRORED || count <= to_end)
+		*out_count = count;
+	else
+		*out_count = to_end;
+	return (cb_slot(cb, pos)->data);
+}
+
+uint32_t cb_push_claim_n(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+	assert(max > 0 && "max must be > 0");
+
+	return (cb_push_claim_range(cb, max, out_pos));
+}
+
+void cb_push_publish_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (cb_cursors(cb))
+	{
+		for (uint32_t i = 0; i < count && (cb->flags & CB_FLAG_JOURNAL); ++i)
+			atomic_store_explicit(&cb_slot(cb, pos + i)->seq, pos + i + 1, memory_order_relaxed);
+		cb_spsc_advance(cb, &cb->head, &cb->head_pending, pos, count);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			atomic_store_explicit(&cb_slot(cb, pos + i)->seq, cb_seq_full(cb, pos + i), memory_order_release);
+	}
+	cb_watermark(cb, pos, count, 1);
+}
+
+uint32_t cb_pop_claim_n(CircularBuffer *cb, uint32_t max, cb_seq_t *out_pos)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+	assert(max > 0 && "max must be > 0");
+
+	return (cb_pop_claim_range(cb, max, out_pos));
+}
+
+uint32_t cb_pop_peek_n(CircularBuffer *cb, void **slots, uint32_t max, cb_seq_t *out_pos)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(slots != NULL && "slots is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+	assert(max > 0 && "max must be > 0");
+
+	uint32_t n = cb_pop_claim_range(cb, max, out_pos);
+
+	for (uint32_t i = 0; i < n; ++i)
+		slots[i] = cb_slot(cb, *out_pos + i)->data;
+	return (n);
+}
+
+void cb_pop_release_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (cb_cursors(cb))
+		cb_spsc_advance(cb, &cb->tail, &cb->tail_pending, pos, count);
+	else
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			atomic_store_explicit(&cb_slot(cb, pos + i)->seq, cb_seq_freed(cb, pos + i), memory_order_release);
+	}
+	cb_watermark(cb, pos, count, 0);
+}
+
+void cb_push_unclaim_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(!(cb->mode & CB_MPSC) && "unclaim needs a single producer");
+
+	if (count == 0)
+		return;
+	if (cb_cursors(cb))
+	{
+		assert(pos + count == cb->head_claim && "not the end of the last claim");
+		cb->head_claim = pos;
+	}
+	else
+	{
+		assert(pos + count == atomic_load_explicit(&cb->head, memory_order_relaxed)
+				&& "not the end of the last claim");
+		atomic_store_explicit(&cb->head, pos, memory_order_relaxed);
+	}
+}
+
+void cb_pop_unclaim_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(!(cb->mode & CB_SPMC) && "unclaim needs a single consumer");
+
+	if (count == 0)
+		return;
+	if (cb_cursors(cb))
+	{
+		assert(pos + count == cb->tail_claim && "not the end of the last claim");
+		cb->tail_claim = pos;
+	}
+	else
+	{
+		assert(pos + count == atomic_load_explicit(&cb->tail, memory_order_relaxed)
+				&& "not the end of the last claim");
+		atomic_store_explicit(&cb->tail, pos, memory_order_relaxed);
+	}
+}
+
+void cb_push_skip_n(CircularBuffer *cb, cb_seq_t pos, uint32_t count)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (!(cb->mode & CB_MPSC))
+	{
+		cb_push_unclaim_n(cb, pos, count);
+		return;
+	}
+	/* Already "released" for this lap: the next lap's producer finds the
+	   slot free, and consumers see a seq past pos + 1 with tail still at
+	   pos and step over it (cb_seq_claim). */
+	for (uint32_t i = 0; i < count; ++i)
+		atomic_store_explicit(&cb_slot(cb, pos + i)->seq, cb_seq_freed(cb, pos + i), memory_order_release);
+}
+
+uint32_t cb_recover(CircularBuffer *cb, cb_seq_t tail)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert((cb->flags & CB_FLAG_JOURNAL) && "cb_recover needs CB_FLAG_JOURNAL");
+
+	uint32_t	capacity = cb->mask + 1;
+	uint32_t	n = 0;
+
+	/* With one consumer releasing in order, a slot from tail on that holds
+	   neither this lap's message nor a filler was never published. */
+	for (uint32_t i = 0; i < capacity; ++i)
+	{
+		cb_seq_t seq = atomic_load_explicit(&cb_slot(cb, tail + i)->seq, memory_order_relaxed);
+
+		if (seq == tail + i + 1)
+			n = i + 1;
+		else if (seq != cb_seq_freed(cb, tail + i) || !(cb->mode & CB_MPSC))
+			break;
+	}
+	for (uint32_t i = n; i < capacity; ++i)
+		atomic_store_explicit(&cb_slot(cb, tail + i)->seq, tail + i, memory_order_relaxed);
+
+	cb_seq_t head = tail + n;
+
+	atomic_store_explicit(&cb->head, head, memory_order_relaxed);
+	atomic_store_explicit(&cb->tail, tail, memory_order_relaxed);
+	cb->head_claim = head;
+	cb->head_pending = head;
+	cb->tail_cache = tail;
+	cb->tail_claim = tail;
+	cb->tail_pending = tail;
+	cb->head_cache = tail;
+	atomic_store_explicit(&cb->push_waiters, 0, memory_order_relaxed);
+	atomic_store_explicit(&cb->pop_waiters, 0, memory_order_relaxed);
+	atomic_store_explicit(&cb->wm_state, 0, memory_order_relaxed);
+#ifdef CIRCBUF_STATS
+	cb_stats_reset(cb);
+#endif
+	atomic_thread_fence(memory_order_release);
+	return (n);
+}
+
+void cb_push_flush(CircularBuffer *cb)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (cb->pub_mask)
+		cb_spsc_flush(&cb->head, cb->head_pending);
+}
+
+void cb_pop_flush(CircularBuffer *cb)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	if (cb->pub_mask)
+		cb_spsc_flush(&cb->tail, cb->tail_pending);
+}
+
+/* -- Bulk copy -- */
+
+/* memcpy with non-temporal stores for the 16-byte aligned middle of dst.
+   Callers fence once with cb_stream_fence before publishing. */
+static inline void	cb_copy_stream(void *dst, const void *src, size_t len)
+{
+#ifdef __SSE2__
+	uint8_t			*d = (uint8_t *)dst;
+	const uint8_t	*s = (const uint8_t *)src;
+	size_t			head = (size_t)(-(uintptr_t)d & 15);
+
+	if (len < head + 16)
+	{
+		memcpy(d, s, len);
+		return;
+	}
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+	for (; len >= 16; len -= 16, d += 16, s += 16)
+		_mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+	memcpy(d, s, len);
+#else
+	memcpy(dst, src, len);
+#endif
+}
+
+/* Streaming stores are weakly ordered: drain them before the release
+   store that publishes the slots. */
+static inline void	cb_stream_fence(void)
+{
+#ifdef __SSE2__
+	_mm_sfence();
+#endif
+}
+
+uint32_t cb_push_bulk(CircularBuffer *cb, const void *src, uint32_t rec_size, uint32_t count, uint32_t flags)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(src != NULL && "src is NULL");
+	assert(rec_size <= cb->slot_size && "rec_size exceeds slot_size");
+	if (!cb || !src || rec_size > cb->slot_size || count == 0)
+		return (0);
+
+	cb_seq_t		pos;
+	uint32_t		n = cb_push_claim_range(cb, count, &pos);
+	const uint8_t	*in = (const uint8_t *)src;
+
+	if (n == 0)
+		return (0); // Full/Empty
+
+	for (uint32_t done = 0, span; done < n; done += span)
+	{
+		uint8_t *slot = cb_slot_span(cb, pos + done, n - done, &span);
+
+		for (uint32_t i = 0; i < span; ++i, slot += cb->stride, in += rec_size)
+		{
+			if (flags & CB_BULK_STREAM)
+				cb_copy_stream(slot, in, rec_size);
+			else
+				memcpy(slot, in, rec_size);
+		}
+	}
+	if (flags & CB_BULK_STREAM)
+		cb_stream_fence();
+	cb_push_publish_n(cb, pos, n);
+	return (n);
+}
+
+uint32_t cb_pop_bulk(CircularBuffer *cb, void *dst, uint32_t rec_size, uint32_t count, uint32_t flags)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(dst != NULL && "dst is NULL");
+	assert(rec_size <= cb->slot_size && "rec_size exceeds slot_size");
+	if (!cb || !dst || rec_size > cb->slot_size || count == 0)
+		return (0);
+
+	cb_seq_t	pos;
+	uint32_t	n = cb_pop_claim_range(cb, count, &pos);
+	uint8_t		*out = (uint8_t *)dst;
+
+	if (n == 0)
+		return (0); // Full/Empty
+
+	for (uint32_t done = 0, span; done < n; done += span)
+	{
+		const uint8_t *slot = cb_slot_span(cb, pos + done, n - done, &span);
+
+		for (uint32_t i = 0; i < span; ++i, slot += cb->stride, out += rec_size)
+		{
+			if (flags & CB_BULK_STREAM)
+				cb_copy_stream(out, slot, rec_size);
+			else
+				memcpy(out, slot, rec_size);
+		}
+	}
+	if (flags & CB_BULK_STREAM)
+		cb_stream_fence();
+	cb_pop_release_n(cb, pos, n);
+	return (n);
+}
+
+/* -- Stats -- */
+
+#ifdef CIRCBUF_STATS
+void cb_stats_snapshot(CircularBuffer *cb, CbStats *out)
+{
+	assert(cb != NULL && "cb is NULL");
+	assert(out != NULL && "out is NULL");
+
+	memset(out, 0, sizeof(*out));
+	for (uint32_t i = 0; i < CIRCBUF_STATS_SHARDS; ++i)
+	{
+		CbStatsShard	*s = &cb->stats[i];
+		uint64_t		hw = atomic_load_explicit(&s->high_water, memory_order_relaxed);
+
+		out->push_ok += atomic_load_explicit(&s->push_ok, memory_order_relaxed);
+		out->pop_ok += atomic_load_explicit(&s->pop_ok, memory_order_relaxed);
+		out->push_full += atomic_load_explicit(&s->push_full, memory_order_relaxed);
+		out->pop_empty += atomic_load_explicit(&s->pop_empty, memory_order_relaxed);
+		out->cas_failures += atomic_load_explicit(&s->cas_failures, memory_order_relaxed);
+		out->stale_retries += atomic_load_explicit(&s->stale_retries, memory_order_relaxed);
+		if (hw > out->high_water)
+			out->high_water = hw;
+	}
+}
+
+void cb_stats_reset(CircularBuffer *cb)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	for (uint32_t i = 0; i < CIRCBUF_STATS_SHARDS; ++i)
+	{
+		CbStatsShard *s = &cb->stats[i];
+
+		atomic_store_explicit(&s->push_ok, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->pop_ok, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->push_full, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->pop_empty, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->cas_failures, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->stale_retries, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->high_water, 0, memory_order_relaxed);
+	}
+}
+#endif
+
+/* -- Blocking layer -- */
+
+int64_t	cb_now_ns(void)
+{
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC); // No POSIX clocks
+#endif
+	return ((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* Sleeps while *word == expected, at most timeout_ns (< 0 = forever).
+   shared selects process-shared futexes (CB_FLAG_SHARED rings). */
+static inline void	cb_futex_wait(_Atomic uint32_t *word, uint32_t expected, int64_t timeout_ns, int shared)
+{
+#ifdef __linux__
+	struct timespec ts;
+
+	if (timeout_ns >= 0)
+	{
+		ts.tv_sec = timeout_ns / 1000000000;
+		ts.tv_nsec = timeout_ns % 1000000000;
+	}
+	syscall(SYS_futex, (uint32_t *)word, shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected,
+		timeout_ns >= 0 ? &ts : NULL, NULL, 0);
+#else
+	(void)timeout_ns;
+	(void)shared;
+	if (atomic_load_explicit(word, memory_order_acquire) == expected)
+		sched_yield();
+#endif
+}
+
+static inline void	cb_futex_wake(_Atomic uint32_t *word, int count, int shared)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (uint32_t *)word, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#else
+	(void)word;
+	(void)count;
+	(void)shared;
+#endif
+}
+
+/* Waker side of the waiters/event handshake: the fence orders our
+   publish/release before the waiters load, pairing with the sleeper's
+   increment before its re-check, so no wakeup is lost. */
+static inline void	cb_notify(_Atomic uint32_t *waiters, _Atomic uint32_t *event, int shared)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(waiters, memory_order_relaxed) == 0)
+		return;
+	atomic_fetch_add_explicit(event, 1, memory_order_release);
+	cb_futex_wake(event, 1, shared);
+}
+
+void cb_notify_consumers(CircularBuffer *cb)
+{
+	assert(cb != NULL && "cb is NULL");
+	cb_notify(&cb->pop_waiters, &cb->not_empty, cb->flags & CB_FLAG_SHARED);
+}
+
+void cb_notify_producers(CircularBuffer *cb)
+{
+	assert(cb != NULL && "cb is NULL");
+	cb_notify(&cb->push_waiters, &cb->not_full, cb->flags & CB_FLAG_SHARED);
+}
+
+int cb_push_wait(CircularBuffer *cb, const void *data, uint32_t size, int64_t timeout_ns)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	int64_t		deadline = timeout_ns >= 0 ? cb_now_ns() + timeout_ns : -1;
+	uint32_t	attempt = 0;
+	int			ret;
+
+	while ((ret = cb_push(cb, data, size)) == -1)
+	{
+		if (attempt < CIRCBUF_WAIT_SPINS)
+			cb_cpu_relax();
+		else if (attempt < CIRCBUF_WAIT_SPINS + CIRCBUF_WAIT_YIELDS)
+			sched_yield();
+		else
+		{
+			int64_t remaining = deadline >= 0 ? deadline - cb_now_ns() : -1;
+			if (deadline >= 0 && remaining <= 0)
+				return (-ETIMEDOUT);
+			atomic_fetch_add_explicit(&cb->push_waiters, 1, memory_order_seq_cst);
+			uint32_t event = atomic_load_explicit(&cb->not_full, memory_order_acquire);
+			if ((ret = cb_push(cb, data, size)) != -1)
+			{
+				atomic_fetch_sub_explicit(&cb->push_waiters, 1, memory_order_relaxed);
+				break;
+			}
+			cb_futex_wait(&cb->not_full, event, remaining, cb->flags & CB_FLAG_SHARED);
+			atomic_fetch_sub_explicit(&cb->push_waiters, 1, memory_order_relaxed);
+		}
+		++attempt;
+	}
+	if (ret == 0)
+	{
+		cb_push_flush(cb);
+		cb_notify_consumers(cb);
+	}
+	return (ret);
+}
+
+int cb_pop_wait(CircularBuffer *cb, void *data, uint32_t size, int64_t timeout_ns)
+{
+	assert(cb != NULL && "cb is NULL");
+
+	int64_t		deadline = timeout_ns >= 0 ? cb_now_ns() + timeout_ns : -1;
+	uint32_t	attempt = 0;
+	int			ret;
+
+	while ((ret = cb_pop(cb, data, size)) == -1)
+	{
+		if (attempt < CIRCBUF_WAIT_SPINS)
+			cb_cpu_relax();
+		else if (attempt < CIRCBUF_WAIT_SPINS + CIRCBUF_WAIT_YIELDS)
+			sched_yield();
+		else
+		{
+			int64_t remaining = deadline >= 0 ? deadline - cb_now_ns() : -1;
+			if (deadline >= 0 && remaining <= 0)
+				return (-ETIMEDOUT);
+			atomic_fetch_add_explicit(&cb->pop_waiters, 1, memory_order_seq_cst);
+			uint32_t event = atomic_load_explicit(&cb->not_empty, memory_order_acquire);
+			if ((ret = cb_pop(cb, data, size)) != -1)
+			{
+				atomic_fetch_sub_explicit(&cb->pop_waiters, 1, memory_order_relaxed);
+				break;
+			}
+			cb_futex_wait(&cb->not_empty, event, remaining, cb->flags & CB_FLAG_SHARED);
+			atomic_fetch_sub_explicit(&cb->pop_waiters, 1, memory_order_relaxed);
+		}
+		++attempt;
+	}
+	if (ret == 0)
+	{
+		cb_pop_flush(cb);
+		cb_notify_producers(cb);
+	}
+	return (ret);
+}
+
+/* -- Variable-length ring -- */
+
+static inline uint32_t	cbb_record_total(uint32_t size) { return (ALIGN_UP((uint32_t)sizeof(ByteRecord) + size, CBB_RECORD_ALIGN)); }
+// Checked before cbb_record_total, which wraps for sizes near UINT32_MAX
+static inline int		cbb_record_fits(CircularByteBuffer *cbb, uint32_t size) { return (size <= cbb->mask + 1 - (uint32_t)sizeof(ByteRecord)); }
+static inline ByteRecord	*cbb_record(CircularByteBuffer *cbb, cb_seq_t pos) { return ((ByteRecord *)(cbb->data + (size_t)(pos & cbb->mask))); }
+
+int	cbb_init(CircularByteBuffer *cbb, Allocator alloc, uint32_t capacity)
+{
+	return (cbb_init_ex(cbb, alloc, capacity, 0));
+}
+
+int	cbb_init_ex(CircularByteBuffer *cbb, Allocator alloc, uint32_t capacity, uint32_t flags)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	assert(alloc.alloc != NULL && "allocator must provide alloc function");
+	assert(cb_is_power_of_two(capacity) && "capacity must be a power of two");
+	assert(capacity >= 2 * sizeof(ByteRecord) && "capacity too small");
+
+	if (!cbb || !alloc.alloc || !cb_is_power_of_two(capacity) || capacity < 2 * sizeof(ByteRecord))
+		return (-EINVAL);
+
+	cbb->alloc = alloc;
+	cbb->mask = capacity - 1;
+	cbb->flags = flags;
+	cbb->data = alloc.alloc(alloc.ctx, capacity, CIRCBUF_CACHE_LINE);
+
+	if (!cbb->data)
+		return (-ENOMEM);
+
+	atomic_init(&cbb->head, 0);
+	atomic_init(&cbb->tail, 0);
+	cbb->head_claim = 0;
+	cbb->tail_cache = 0;
+	cbb->tail_claim = 0;
+	cbb->head_cache = 0;
+	return (0);
+}
+
+void cbb_free(CircularByteBuffer *cbb)
+{
+	if (!cbb || !cbb->data)
+		return;
+	if (cbb->alloc.free)
+		cbb->alloc.free(cbb->alloc.ctx, cbb->data);
+	cbb->data = NULL;
+}
+
+static inline int	cbb_has_room(CircularByteBuffer *cbb, cb_seq_t pos, uint32_t need)
+{
+	if (need <= cbb->mask + 1 - (pos - cbb->tail_cache))
+		return (1);
+	cbb->tail_cache = atomic_load_explicit(&cbb->tail, memory_order_acquire);
+	return (need <= cbb->mask + 1 - (pos - cbb->tail_cache));
+}
+
+void *cbb_push_claim(CircularByteBuffer *cbb, uint32_t size, cb_seq_t *out_pos)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+	assert(cbb_record_fits(cbb, size) && "record exceeds capacity");
+	if (!cbb_record_fits(cbb, size))
+		return (NULL);
+
+	cb_seq_t pos = cbb->head_claim;
+	uint32_t total = cbb_record_total(size);
+	uint32_t to_end = cbb->mask + 1 - (uint32_t)(pos & cbb->mask);
+
+	if (total > to_end && !(cbb->flags & CB_FLAG_MIRRORED))
+	{
+		/* Doesn't fit before the end: publish a padding record over the
+		   remainder on its own, so the consumer can skip and free it even
+		   if the record itself has to wait for more room. */
+		if (!cbb_has_room(cbb, pos, to_end))
+			return (NULL); // Full
+		ByteRecord *pad = cbb_record(cbb, pos);
+		pad->size = to_end - sizeof(ByteRecord);
+		pad->flags = CBB_RECORD_PAD;
+		pos += to_end;
+		cbb->head_claim = pos;
+		atomic_store_explicit(&cbb->head, pos, memory_order_release);
+	}
+	if (!cbb_has_room(cbb, pos, total))
+		return (NULL); // Full
+
+	ByteRecord *rec = cbb_record(cbb, pos);
+	rec->size = size;
+	rec->flags = 0;
+	cbb->head_claim = pos + total;
+	*out_pos = pos;
+	return (rec + 1);
+}
+
+void cbb_push_publish(CircularByteBuffer *cbb, cb_seq_t pos)
+{
+	assert(cbb != NULL && "cbb is NULL");
+
+	uint32_t total = cbb_record_total(cbb_record(cbb, pos)->size);
+	atomic_store_explicit(&cbb->head, pos + total, memory_order_release);
+}
+
+void cbb_push_publish_size(CircularByteBuffer *cbb, cb_seq_t pos, uint32_t size)
+{
+	assert(cbb != NULL && "cbb is NULL");
+
+	ByteRecord *rec = cbb_record(cbb, pos);
+
+	assert(size <= rec->size && "size exceeds the claimed record");
+	assert(pos + cbb_record_total(rec->size) == cbb->head_claim && "not the outstanding claim");
+	rec->size = size;
+	cbb->head_claim = pos + cbb_record_total(size);
+	atomic_store_explicit(&cbb->head, cbb->head_claim, memory_order_release);
+}
+
+void cbb_push_cancel(CircularByteBuffer *cbb, cb_seq_t pos)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	assert(pos + cbb_record_total(cbb_record(cbb, pos)->size) == cbb->head_claim
+			&& "not the outstanding claim");
+
+	cbb->head_claim = pos; // Any padding record before it stays published
+}
+
+void *cbb_pop_claim(CircularByteBuffer *cbb, uint32_t *out_size, cb_seq_t *out_pos)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	assert(out_size != NULL && "out_size is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+
+	cb_seq_t pos = cbb->tail_claim;
+	for (;;)
+	{
+		if (pos == cbb->head_cache)
+		{
+			cbb->head_cache = atomic_load_explicit(&cbb->head, memory_order_acquire);
+			if (pos == cbb->head_cache)
+				return (NULL); // Empty
+		}
+		ByteRecord *rec = cbb_record(cbb, pos);
+		if (!(rec->flags & CBB_RECORD_PAD))
+		{
+			cbb->tail_claim = pos + cbb_record_total(rec->size);
+			*out_size = rec->size;
+			*out_pos = pos;
+			return (rec + 1);
+		}
+		pos += cbb_record_total(rec->size);
+		cbb->tail_claim = pos;
+		atomic_store_explicit(&cbb->tail, pos, memory_order_release);
+	}
+}
+
+void cbb_pop_release(CircularByteBuffer *cbb, cb_seq_t pos)
+{
+	assert(cbb != NULL && "cbb is NULL");
+
+	uint32_t total = cbb_record_total(cbb_record(cbb, pos)->size);
+	atomic_store_explicit(&cbb->tail, pos + total, memory_order_release);
+}
+
+void cbb_pop_unclaim(CircularByteBuffer *cbb, cb_seq_t pos)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	// The byte ring has a single consumer, so the claim is the consumer's own
+	assert(pos + cbb_record_total(cbb_record(cbb, pos)->size) == cbb->tail_claim
+			&& "not the outstanding claim");
+
+	cbb->tail_claim = pos;
+}
+
+int	cbb_push(CircularByteBuffer *cbb, const void *data, uint32_t size)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	assert(data != NULL || size == 0);
+
+	if (!cbb || (!data && size) || !cbb_record_fits(cbb, size))
+		return (-EINVAL);
+
+	cb_seq_t	pos;
+	void		*rec_data = cbb_push_claim(cbb, size, &pos);
+
+	if (!rec_data)
+		return (-1); // Full
+
+	memcpy(rec_data, data, size);
+	cbb_push_publish(cbb, pos);
+	return (0);
+}
+
+int cbb_pop(CircularByteBuffer *cbb, void *data, uint32_t max_size, uint32_t *out_size)
+{
+	assert(cbb != NULL && "cbb is NULL");
+	assert(data != NULL && "data is NULL");
+	assert(out_size != NULL && "out_size is NULL");
+
+	if (!cbb || !data || !out_size)
+		return (-EINVAL);
+
+	cb_seq_t	pos;
+	uint32_t	size;
+	void		*rec_data = cbb_pop_claim(cbb, &size, &pos);
+
+	if (!rec_data)
+		return (-1); // Empty
+	if (size > max_size)
+	{
+		cbb_pop_unclaim(cbb, pos); // Leave it queued for a larger buffer
+		return (-EMSGSIZE);
+	}
+
+	memcpy(data, rec_data, size);
+	cbb_pop_release(cbb, pos);
+	*out_size = size;
 	return (0);
 }
 
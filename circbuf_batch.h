@@ -0,0 +1,112 @@
+#ifndef CIRCBUF_BATCH_H
+# define CIRCBUF_BATCH_H
+
+#include "circbuf.h"
+
+/* -- Producer batching front-end --
+   A per-thread handle for multi-producer rings whose producers make one
+   message at a time. It claims chunk positions from head with a single
+   CAS (cb_push_claim_n), then hands them out one by one; each slot is
+   published as soon as it is filled, so consumers see messages without
+   waiting for the rest of the chunk. N producers then contend on head
+   once per chunk instead of once per message.
+
+   The cost is that claimed but unfilled positions hold up consumers
+   behind them. cb_batch_flush gives the rest of the chunk back as
+   fillers consumers step over (cb_push_skip_n); call it before the thread
+   goes idle or exits, or call cb_batch_poll from the idle path to flush
+   only once the chunk has been open for flush_ns. Fillers still take
+   ring capacity for one lap, so keep chunk well below the capacity.
+
+   One handle per producer thread. The handle does not wake consumers
+   sleeping in cb_pop_wait; use cb_notify_consumers for that. */
+
+typedef struct {
+	CircularBuffer	*cb;
+	cb_seq_t		pos;		// next claimed position to hand out
+	uint32_t		left;		// claimed positions not handed out yet
+	uint32_t		chunk;
+	int64_t			flush_ns;	// cb_batch_poll threshold, < 0 = never
+	int64_t			claimed_at;	// when the current chunk was claimed
+} CbPushBatch;
+
+static inline void	cb_batch_init(CbPushBatch *b, CircularBuffer *cb, uint32_t chunk, int64_t flush_ns)
+{
+	assert(b != NULL && cb != NULL && "b and cb are required");
+	assert(chunk > 0 && chunk <= cb->mask + 1 && "chunk must be in [1, capacity]");
+
+	b->cb = cb;
+	b->pos = 0;
+	b->left = 0;
+	b->chunk = chunk;
+	b->flush_ns = flush_ns;
+	b->claimed_at = 0;
+}
+
+/* Returns the next slot to fill, its position in *out_pos, or NULL if the
+   ring is full. Publish it with cb_batch_publish. */
+static inline void	*cb_batch_claim(CbPushBatch *b, cb_seq_t *out_pos)
+{
+	assert(b != NULL && "b is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+
+	if (b->left == 0)
+	{
+		b->left = cb_push_claim_n(b->cb, b->chunk, &b->pos);
+		if (b->left == 0)
+			return (NULL); // Full
+		if (b->flush_ns > 0)
+			b->claimed_at = cb_now_ns();
+	}
+	*out_pos = b->pos++;
+	b->left--;
+	return (cb_slot_data(b->cb, *out_pos));
+}
+
+static inline void	cb_batch_publish(CbPushBatch *b, cb_seq_t pos)
+{
+	assert(b != NULL && "b is NULL");
+	cb_push_publish(b->cb, pos);
+}
+
+/* Copying wrapper: 0 on success, -1 when full. */
+static inline int	cb_batch_push(CbPushBatch *b, const void *data, uint32_t size)
+{
+	assert(size <= b->cb->slot_size && "size exceeds slot_size");
+
+	cb_seq_t	pos;
+	void		*slot = cb_batch_claim(b, &pos);
+
+	if (!slot)
+		return (-1);
+	memcpy(slot, data, size);
+	cb_batch_publish(b, pos);
+	return (0);
+}
+
+/* Hands the unused rest of the chunk back to the ring. */
+static inline void	cb_batch_flush(CbPushBatch *b)
+{
+	assert(b != NULL && "b is NULL");
+
+	if (b->left == 0)
+		return;
+	cb_push_skip_n(b->cb, b->pos, b->left);
+	b->pos += b->left;
+	b->left = 0;
+}
+
+/* Idle hook: flushes once the open chunk is flush_ns old. Returns 1 if it
+   flushed. */
+static inline int	cb_batch_poll(CbPushBatch *b)
+{
+	assert(b != NULL && "b is NULL");
+
+	if (b->left == 0 || b->flush_ns < 0
+			|| (b->flush_ns > 0 && cb_now_ns() - b->claimed_at < b->flush_ns))
+		return (0);
+	cb_batch_flush(b);
+	return (1);
+}
+
+#endif // CIRCBUF_BATCH_H
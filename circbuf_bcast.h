@@ -0,0 +1,271 @@
+#ifndef CIRCBUF_BCAST_H
+# define CIRCBUF_BCAST_H
+
+#include "circbuf.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+
+/* -- Broadcast ring --
+   One producer, up to max_readers independent readers, each of which sees
+   every message (Disruptor-style). A slot is not handed out once and
+   recycled by its consumer as in the seq protocol: every reader keeps its
+   own cursor on its own cache line, and the producer may only overwrite a
+   slot once the slowest active reader has moved past it.
+
+   The producer gates on a cached minimum of the reader cursors and only
+   rescans them when that cached bound says the ring is full, so in steady
+   state a push touches no reader line at all. The rescan and reader
+   registration share a small lock; neither is on the fast path. A reader
+   that subscribes starts at the current head (it sees messages published
+   from then on); one that unsubscribes stops gating the producer at its
+   next rescan. With no readers the producer never blocks and messages are
+   simply overwritten.
+
+   Each reader id must be driven by a single thread, and the producer side
+   by a single thread; releases must be issued in claim order. */
+
+# ifndef CB_BCAST_MAX_READERS
+#  define CB_BCAST_MAX_READERS 64
+# endif
+
+typedef struct {
+	_Alignas(64) _Atomic cb_seq_t	cursor;		// next position to read, stored on release
+	_Atomic uint32_t				active;
+	cb_seq_t						claim;		// reader-local
+	cb_seq_t						head_cache;	// reader-local
+} CbBcastReader;
+
+typedef struct {
+	uint8_t							*slots;
+	CbBcastReader					*readers;
+	uint32_t						slot_size;
+	uint32_t						stride;
+	uint32_t						mask;
+	uint32_t						max_readers;
+	Allocator						alloc;
+	_Alignas(64) _Atomic cb_seq_t	head;		// published
+	cb_seq_t						head_claim;	// producer-local
+	cb_seq_t						gate_cache;	// producer-local: min reader cursor at last rescan
+	_Alignas(64) atomic_flag		lock;		// rescan vs subscribe
+} CircularBroadcast;
+
+static inline void	*cbcast_slot_data(CircularBroadcast *bc, cb_seq_t pos)
+{
+	return (bc->slots + (size_t)(pos & bc->mask) * bc->stride);
+}
+
+static inline int	cbcast_init(CircularBroadcast *bc, Allocator alloc, uint32_t capacity, uint32_t slot_size,
+	uint32_t max_readers)
+{
+	assert(bc != NULL && "bc is NULL");
+	assert(alloc.alloc != NULL && "allocator must provide alloc function");
+	assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "capacity must be a power of two");
+	assert(slot_size > 0 && "slot_size must be > 0");
+	assert(max_readers > 0 && max_readers <= CB_BCAST_MAX_READERS && "invalid max_readers");
+
+	if (!bc || !alloc.alloc || capacity == 0 || (capacity & (capacity - 1)) != 0 || slot_size == 0
+			|| max_readers == 0 || max_readers > CB_BCAST_MAX_READERS)
+		return (-EINVAL);
+
+	bc->alloc = alloc;
+	bc->slot_size = slot_size;
+	bc->stride = (slot_size + 7) & ~7u;
+	bc->mask = capacity - 1;
+	bc->max_readers = max_readers;
+	bc->slots = alloc.alloc(alloc.ctx, (size_t)capacity * bc->stride, CIRCBUF_CACHE_LINE);
+	bc->readers = alloc.alloc(alloc.ctx, max_readers * sizeof(CbBcastReader), CIRCBUF_CACHE_LINE);
+	if (!bc->slots || !bc->readers)
+	{
+		if (alloc.free)
+		{
+			alloc.free(alloc.ctx, bc->slots);
+			alloc.free(alloc.ctx, bc->readers);
+		}
+		bc->slots = NULL;
+		bc->readers = NULL;
+		return (-ENOMEM);
+	}
+
+	for (uint32_t i = 0; i < max_readers; ++i)
+	{
+		atomic_init(&bc->readers[i].cursor, 0);
+		atomic_init(&bc->readers[i].active, 0);
+		bc->readers[i].claim = 0;
+		bc->readers[i].head_cache = 0;
+	}
+	atomic_init(&bc->head, 0);
+	bc->head_claim = 0;
+	bc->gate_cache = 0;
+	atomic_flag_clear(&bc->lock);
+	return (0);
+}
+
+static inline void	cbcast_free(CircularBroadcast *bc)
+{
+	if (!bc || !bc->slots)
+		return;
+	if (bc->alloc.free)
+	{
+		bc->alloc.free(bc->alloc.ctx, bc->slots);
+		bc->alloc.free(bc->alloc.ctx, bc->readers);
+	}
+	bc->slots = NULL;
+	bc->readers = NULL;
+}
+
+static inline void	cbcast_lock(CircularBroadcast *bc)
+{
+	while (atomic_flag_test_and_set_explicit(&bc->lock, memory_order_acquire))
+		sched_yield(); // Held for one scan of max_readers cursors at most
+}
+
+static inline void	cbcast_unlock(CircularBroadcast *bc)
+{
+	atomic_flag_clear_explicit(&bc->lock, memory_order_release);
+}
+
+/* Registers a reader starting at the current head. Returns its id, or
+   -EBUSY when all max_readers ids are taken. */
+static inline int	cbcast_subscribe(CircularBroadcast *bc)
+{
+	assert(bc != NULL && "bc is NULL");
+
+	int id = -EBUSY;
+
+	cbcast_lock(bc);
+	for (uint32_t i = 0; i < bc->max_readers; ++i)
+	{
+		CbBcastReader *r = &bc->readers[i];
+		if (atomic_load_explicit(&r->active, memory_order_relaxed))
+			continue;
+		/* head >= gate_cache, and the gate only moves under the lock, so
+		   the producer cannot overwrite anything from here on before its
+		   next rescan sees this reader. */
+		cb_seq_t head = atomic_load_explicit(&bc->head, memory_order_acquire);
+		r->claim = head;
+		r->head_cache = head;
+		atomic_store_explicit(&r->cursor, head, memory_order_relaxed);
+		atomic_store_explicit(&r->active, 1, memory_order_release);
+		id = (int)i;
+		break;
+	}
+	cbcast_unlock(bc);
+	return (id);
+}
+
+static inline void	cbcast_unsubscribe(CircularBroadcast *bc, int id)
+{
+	assert(bc != NULL && id >= 0 && (uint32_t)id < bc->max_readers && "invalid reader id");
+	atomic_store_explicit(&bc->readers[id].active, 0, memory_order_release);
+}
+
+/* Recomputes the minimum cursor over active readers. */
+static inline cb_seq_t	cbcast_rescan(CircularBroadcast *bc)
+{
+	cb_seq_t gate = atomic_load_explicit(&bc->head, memory_order_relaxed); // Not head_claim: keeps gate <= head
+
+	cbcast_lock(bc);
+	for (uint32_t i = 0; i < bc->max_readers; ++i)
+	{
+		CbBcastReader *r = &bc->readers[i];
+		if (!atomic_load_explicit(&r->active, memory_order_acquire))
+			continue;
+		cb_seq_t cursor = atomic_load_explicit(&r->cursor, memory_order_acquire);
+		if ((cb_sdiff_t)(cursor - gate) < 0)
+			gate = cursor;
+	}
+	bc->gate_cache = gate;
+	cbcast_unlock(bc);
+	return (gate);
+}
+
+/* Claims up to max contiguous positions for writing. Returns the number
+   claimed (0 if the slowest reader is a full ring behind), start in
+   *out_pos; fill them with cbcast_slot_data(bc, pos + i). */
+static inline uint32_t	cbcast_push_claim_n(CircularBroadcast *bc, uint32_t max, cb_seq_t *out_pos)
+{
+	assert(bc != NULL && "bc is NULL");
+	assert(out_pos != NULL && "out_pos is NULL");
+
+	cb_seq_t	pos = bc->head_claim;
+	uint32_t	capacity = bc->mask + 1;
+	uint32_t	room = capacity - (uint32_t)(pos - bc->gate_cache);
+
+	if (room < max)
+		room = capacity - (uint32_t)(pos - cbcast_rescan(bc));
+	if (room == 0)
+		return (0); // Full
+	if (max > room)
+		max = room;
+	bc->head_claim = pos + max;
+	*out_pos = pos;
+	return (max);
+}
+
+static inline void	cbcast_push_publish_n(CircularBroadcast *bc, cb_seq_t pos, uint32_t count)
+{
+	assert(bc != NULL && "bc is NULL");
+	atomic_store_explicit(&bc->head, pos + count, memory_order_release);
+}
+
+/* Claims up to max positions reader id has not seen yet. Returns the
+   number claimed (0 if it is caught up), start in *out_pos. */
+static inline uint32_t	cbcast_read_claim_n(CircularBroadcast *bc, int id, uint32_t max, cb_seq_t *out_pos)
+{
+	assert(bc != NULL && id >= 0 && (uint32_t)id < bc->max_readers && "invalid reader id");
+	assert(out_pos != NULL && "out_pos is NULL");
+
+	CbBcastReader	*r = &bc->readers[id];
+	cb_seq_t		pos = r->claim;
+	uint32_t		avail = (uint32_t)(r->head_cache - pos);
+
+	if (avail < max)
+	{
+		r->head_cache = atomic_load_explicit(&bc->head, memory_order_acquire);
+		avail = (uint32_t)(r->head_cache - pos);
+	}
+	if (avail == 0)
+		return (0); // Caught up
+	if (max > avail)
+		max = avail;
+	r->claim = pos + max;
+	*out_pos = pos;
+	return (max);
+}
+
+/* Done reading [pos, pos + count): lets the producer reuse those slots
+   once every other reader is past them too. */
+static inline void	cbcast_read_release_n(CircularBroadcast *bc, int id, cb_seq_t pos, uint32_t count)
+{
+	assert(bc != NULL && id >= 0 && (uint32_t)id < bc->max_readers && "invalid reader id");
+	atomic_store_explicit(&bc->readers[id].cursor, pos + count, memory_order_release);
+}
+
+/* Copying wrappers: 0 on success, -1 when full / caught up. */
+static inline int	cbcast_push(CircularBroadcast *bc, const void *data, uint32_t size)
+{
+	assert(size <= bc->slot_size && "size exceeds slot_size");
+
+	cb_seq_t pos;
+	if (cbcast_push_claim_n(bc, 1, &pos) == 0)
+		return (-1);
+	memcpy(cbcast_slot_data(bc, pos), data, size);
+	cbcast_push_publish_n(bc, pos, 1);
+	return (0);
+}
+
+static inline int	cbcast_read(CircularBroadcast *bc, int id, void *data, uint32_t size)
+{
+	assert(size <= bc->slot_size && "size exceeds slot_size");
+
+	cb_seq_t pos;
+	if (cbcast_read_claim_n(bc, id, 1, &pos) == 0)
+		return (-1);
+	memcpy(data, cbcast_slot_data(bc, pos), size);
+	cbcast_read_release_n(bc, id, pos, 1);
+	return (0);
+}
+
+#endif // CIRCBUF_BCAST_H
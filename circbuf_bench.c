@@ -0,0 +1,784 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#define CIRCBUF_IMPLEMENTATION
+#include "circbuf.h"
+#include "mmap_allocator.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+/*
+   Benchmark harness. List options take comma-separated values and the
+   harness runs their cross product, skipping combinations the mode does
+   not allow (e.g. SPSC with 4 producers).
+
+     -t  test           stream | pingpong                (default stream)
+     -m  modes          spsc,mpsc,spmc,mpmc              (default spsc,mpmc)
+     -c  capacities     power-of-two slot counts         (default 1024)
+     -s  slot sizes     bytes, at least 16               (default 16)
+     -p  producers      thread counts                    (default 1,4)
+     -q  consumers      thread counts                    (default 1,4)
+     -b  batch sizes    slots per claim_n                (default 1)
+     -l  layouts        packed,padded,swizzled           (default packed)
+     -k  backoffs       none,pause,exp,yield             (default none)
+     -e  engines        cas,faa: MPMC claim via CAS loop or
+                        fetch-and-add (CB_FLAG_FAA)      (default cas)
+     -P  publish        SPSC publish_interval, 0 = store
+                        head/tail on every call          (default 0)
+     -F  prefetch       consumer prefetch_distance in
+                        slots, 0 = off                   (default 0)
+     -n  messages       per run                          (default 4000000)
+     -r  repetitions    per combination                  (default 1)
+     -R  rates          offered load in msg/s, 0 = flat out (default 0)
+     -L  latency        stamp every Nth message, 0 = off (default 64)
+     -a  allocator      malloc | mmap | huge             (default malloc)
+     -C  cpus           list to pin threads to in order, producers first;
+                        "smt" = cpu0 and its SMT sibling,
+                        "cross" = cpu0 and a cpu on another socket
+     -f  format         table | csv | json               (default table)
+
+   stream    producers push to consumers through one ring. The producer
+             stamps the cycle counter into the payload right after
+             push_claim and the consumer reads it back after pop_claim; the
+             p* columns are that one-way latency. With a rate set,
+             producers are paced and stamp the intended send time, so the
+             percentiles include the queueing delay once the ring backs up.
+   pingpong  one thread pings over ring A, another echoes back over ring
+             B, both rings in the chosen mode; the p* columns are round
+             trips, M msg/s is round trips per second. Only -n, -c, -s, -l,
+             -k, -m and -C apply.
+
+   To see what lazy SPSC publishing saves on small messages:
+     -m spsc -P 0,8,64 -s 16 -b 1
+
+   To see whether consumer prefetching pays off for larger slots:
+     -m spsc,mpsc -F 0,4,16 -s 256 -l padded -p 1,4
+
+   To compare the MPMC engines under contention:
+     -m mpmc -e cas,faa -p 2,8,32 -q 2,8,32    (4, 16 and 64 threads)
+
+   Ticks are converted to ns with a calibration against CLOCK_MONOTONIC
+   at startup (rdtsc on x86, cntvct_el0 on arm64, the clock itself
+   elsewhere); the TSC is assumed invariant and synchronised across cores.
+*/
+
+#define MAX_THREADS		64
+#define MAX_LIST		32
+#define HIST_SUB_BITS	5
+#define HIST_SUB		(1u << HIST_SUB_BITS)
+#define HIST_BUCKETS	(HIST_SUB + (64 - HIST_SUB_BITS) * (HIST_SUB / 2))
+
+typedef struct {
+	uint32_t	values[MAX_LIST];
+	uint32_t	count;
+} List;
+
+typedef struct {
+	List		modes;
+	List		capacities;
+	List		slot_sizes;
+	List		producers;
+	List		consumers;
+	List		batches;
+	List		layouts;
+	List		backoffs;
+	List		engines;
+	List		publishes;
+	List		prefetches;
+	List		rates;
+	List		cpus;
+	uint32_t	messages;
+	uint32_t	repetitions;
+	uint32_t	sample_every;
+	const char	*allocator;
+	const char	*format;
+	const char	*test;
+} Options;
+
+static const char	*mode_names[] = { "spsc", "mpsc", "spmc", "mpmc" };
+static const char	*layout_names[] = { "packed", "padded", "swizzled" };
+static const char	*backoff_names[] = { "none", "pause", "exp", "yield" };
+static const char	*engine_names[] = { "cas", "faa" };
+
+/* -- Latency histogram --
+   Values below HIST_SUB are exact; above that each power of two is split
+   into HIST_SUB / 2 buckets, so any recorded value is within ~3%. */
+
+typedef struct {
+	uint64_t	buckets[HIST_BUCKETS];
+	uint64_t	count;
+	uint64_t	max;
+} Histogram;
+
+static uint32_t hist_index(uint64_t v)
+{
+	if (v < HIST_SUB)
+		return ((uint32_t)v);
+
+	uint32_t shift = (uint32_t)(63 - __builtin_clzll(v)) - HIST_SUB_BITS + 1;
+	return (HIST_SUB + (shift - 1) * (HIST_SUB / 2) + (uint32_t)(v >> shift) - HIST_SUB / 2);
+}
+
+static uint64_t hist_value(uint32_t idx)
+{
+	if (idx < HIST_SUB)
+		return (idx);
+
+	uint32_t k = idx - HIST_SUB;
+	uint32_t shift = k / (HIST_SUB / 2) + 1;
+	uint64_t sub = k % (HIST_SUB / 2) + HIST_SUB / 2;
+	return (((sub + 1) << shift) - 1); // Upper edge of the bucket
+}
+
+static void hist_record(Histogram *h, uint64_t v)
+{
+	h->buckets[hist_index(v)]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+static void hist_merge(Histogram *dst, const Histogram *src)
+{
+	for (uint32_t i = 0; i < HIST_BUCKETS; ++i)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+static uint64_t hist_percentile(const Histogram *h, double pct)
+{
+	if (h->count == 0)
+		return (0);
+
+	uint64_t rank = (uint64_t)(pct / 100.0 * (double)(h->count - 1)) + 1;
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < HIST_BUCKETS; ++i)
+	{
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return (hist_value(i) < h->max ? hist_value(i) : h->max);
+	}
+	return (h->max);
+}
+
+/* -- Clock -- */
+
+static double	ns_per_tick = 1.0;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+}
+
+static inline uint64_t bench_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__rdtsc());
+#elif defined(__aarch64__)
+	uint64_t v;
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(v));
+	return (v);
+#else
+	return (now_ns());
+#endif
+}
+
+static void calibrate_ticks(void)
+{
+	uint64_t ns0 = now_ns();
+	uint64_t t0 = bench_ticks();
+
+	while (now_ns() - ns0 < 50000000u) // 50 ms
+		;
+	ns_per_tick = (double)(now_ns() - ns0) / (double)(bench_ticks() - t0);
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+	return ((uint64_t)((double)ticks * ns_per_tick));
+}
+
+/* -- Threads -- */
+
+typedef struct {
+	uint64_t	seq;
+	uint64_t	stamp;	// Ticks, 0 unless sampled for latency
+} BenchHeader;
+
+typedef struct {
+	CircularBuffer		*cb;
+	CircularBuffer		*echo;		// Return ring, pingpong only
+	uint32_t			count;
+	uint32_t			batch;
+	uint32_t			sample_every;
+	uint64_t			interval;	// Ticks between sends, 0 = unpaced
+	int					cpu;		// -1 = not pinned
+	pthread_barrier_t	*start;
+	Histogram			hist;
+} BenchArgs;
+
+static void pin_self(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		fprintf(stderr, "warning: could not pin to cpu %d\n", cpu);
+}
+
+static void *bench_producer(void *arg)
+{
+	BenchArgs	*args = (BenchArgs *)arg;
+	uint64_t	seq = 0;
+	uint64_t	next;
+
+	pin_self(args->cpu);
+	pthread_barrier_wait(args->start);
+	next = bench_ticks();
+	while (seq < args->count)
+	{
+		cb_seq_t	pos;
+		uint32_t	want = args->count - seq < args->batch ? (uint32_t)(args->count - seq) : args->batch;
+
+		if (args->interval)
+		{
+			while (bench_ticks() < next)
+				cb_cpu_relax();
+		}
+
+		uint32_t	n = cb_push_claim_n(args->cb, want, &pos);
+		uint64_t	stamp = args->interval ? next : bench_ticks();
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			BenchHeader *hdr = (BenchHeader *)cb_slot_data(args->cb, pos + i);
+
+			hdr->seq = seq + i;
+			hdr->stamp = args->sample_every && (seq + i) % args->sample_every == 0 ? stamp : 0;
+		}
+		next += args->interval * n;
+		if (n)
+			cb_push_publish_n(args->cb, pos, n);
+		seq += n;
+	}
+	cb_push_flush(args->cb);
+	return (NULL);
+}
+
+static void *bench_consumer(void *arg)
+{
+	BenchArgs	*args = (BenchArgs *)arg;
+	uint64_t	done = 0;
+
+	pin_self(args->cpu);
+	pthread_barrier_wait(args->start);
+	while (done < args->count)
+	{
+		cb_seq_t	pos;
+		uint32_t	want = args->count - done < args->batch ? (uint32_t)(args->count - done) : args->batch;
+		uint32_t	n = cb_pop_claim_n(args->cb, want, &pos);
+
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const BenchHeader *hdr = (const BenchHeader *)cb_slot_data(args->cb, pos + i);
+
+			if (hdr->stamp)
+				hist_record(&args->hist, bench_ticks() - hdr->stamp);
+		}
+		if (n)
+			cb_pop_release_n(args->cb, pos, n);
+		done += n;
+	}
+	return (NULL);
+}
+
+static void *bench_ping(void *arg)
+{
+	BenchArgs	*args = (BenchArgs *)arg;
+	BenchHeader	*hdr;
+	cb_seq_t	pos;
+
+	pin_self(args->cpu);
+	pthread_barrier_wait(args->start);
+	for (uint32_t i = 0; i < args->count; ++i)
+	{
+		while (!(hdr = cb_push_claim(args->cb, &pos)))
+			;
+		hdr->seq = i;
+		hdr->stamp = bench_ticks();
+		cb_push_publish(args->cb, pos);
+
+		while (!(hdr = cb_pop_claim(args->echo, &pos)))
+			;
+		hist_record(&args->hist, bench_ticks() - hdr->stamp);
+		cb_pop_release(args->echo, pos);
+	}
+	return (NULL);
+}
+
+static void *bench_pong(void *arg)
+{
+	BenchArgs	*args = (BenchArgs *)arg;
+	BenchHeader	*in;
+	BenchHeader	*out;
+	cb_seq_t	in_pos;
+	cb_seq_t	out_pos;
+
+	pin_self(args->cpu);
+	pthread_barrier_wait(args->start);
+	for (uint32_t i = 0; i < args->count; ++i)
+	{
+		while (!(in = cb_pop_claim(args->cb, &in_pos)))
+			;
+		while (!(out = cb_push_claim(args->echo, &out_pos)))
+			;
+		*out = *in;
+		cb_push_publish(args->echo, out_pos);
+		cb_pop_release(args->cb, in_pos);
+	}
+	return (NULL);
+}
+
+/* -- Runs -- */
+
+typedef struct {
+	CircularBufferConfig	cfg;
+	uint32_t				producers;
+	uint32_t				consumers;
+	uint32_t				batch;
+	uint32_t				rate;		// msg/s across all producers, 0 = unpaced
+} RunSpec;
+
+typedef struct {
+	uint32_t	stride;
+	double		seconds;
+	double		mmsgs;
+	Histogram	hist;
+} RunResult;
+
+static MmapAllocatorConfig	mmap_cfg = { .numa_node = -1, .flags = MMAP_ALLOC_POPULATE };
+static MmapAllocatorConfig	huge_cfg = { .numa_node = -1, .flags = MMAP_ALLOC_HUGE | MMAP_ALLOC_POPULATE };
+static BenchArgs			thread_args[2 * MAX_THREADS];
+
+static Allocator bench_allocator(const char *name)
+{
+	if (strcmp(name, "mmap") == 0)
+		return (mmap_allocator(&mmap_cfg));
+	if (strcmp(name, "huge") == 0)
+		return (mmap_allocator(&huge_cfg));
+	return (malloc_allocator());
+}
+
+static int run(const Options *opt, const RunSpec *spec, RunResult *res)
+{
+	CircularBuffer		cb;
+	pthread_t			threads[2 * MAX_THREADS];
+	pthread_barrier_t	start;
+	uint32_t			nthreads = spec->producers + spec->consumers;
+	uint32_t			per_prod = opt->messages / spec->producers;
+	uint64_t			total = (uint64_t)per_prod * spec->producers;
+	double				ticks_per_sec = 1e9 / ns_per_tick;
+
+	if (cb_init_ex(&cb, bench_allocator(opt->allocator), &spec->cfg) != 0)
+		return (-1);
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+
+	/* Consumers split the total exactly, the first few taking one extra,
+	   so every thread knows when to stop without a shared counter. */
+	for (uint32_t i = 0; i < nthreads; ++i)
+	{
+		BenchArgs	*args = &thread_args[i];
+		int			is_prod = i < spec->producers;
+		uint32_t	c = i - spec->producers;
+
+		memset(args, 0, sizeof(*args));
+		args->cb = &cb;
+		args->count = is_prod ? per_prod
+			: (uint32_t)(total / spec->consumers + (c < total % spec->consumers));
+		args->batch = spec->batch;
+		args->sample_every = opt->sample_every;
+		args->interval = spec->rate ? (uint64_t)(ticks_per_sec * spec->producers / spec->rate) : 0;
+		args->cpu = opt->cpus.count ? (int)opt->cpus.values[i % opt->cpus.count] : -1;
+		args->start = &start;
+		pthread_create(&threads[i], NULL, is_prod ? bench_producer : bench_consumer, args);
+	}
+
+	pthread_barrier_wait(&start);
+	uint64_t t0 = now_ns();
+	for (uint32_t i = 0; i < nthreads; ++i)
+		pthread_join(threads[i], NULL);
+	uint64_t t1 = now_ns();
+
+	memset(&res->hist, 0, sizeof(res->hist));
+	for (uint32_t i = spec->producers; i < nthreads; ++i)
+		hist_merge(&res->hist, &thread_args[i].hist);
+	res->stride = cb.stride;
+	res->seconds = (double)(t1 - t0) / 1e9;
+	res->mmsgs = (double)total / res->seconds / 1e6;
+
+	pthread_barrier_destroy(&start);
+	cb_free(&cb);
+	return (0);
+}
+
+static int run_pingpong(const Options *opt, const RunSpec *spec, RunResult *res)
+{
+	CircularBuffer		ping;
+	CircularBuffer		pong;
+	pthread_t			threads[2];
+	pthread_barrier_t	start;
+
+	if (cb_init_ex(&ping, bench_allocator(opt->allocator), &spec->cfg) != 0)
+		return (-1);
+	if (cb_init_ex(&pong, bench_allocator(opt->allocator), &spec->cfg) != 0)
+	{
+		cb_free(&ping);
+		return (-1);
+	}
+	pthread_barrier_init(&start, NULL, 3);
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		BenchArgs *args = &thread_args[i];
+
+		memset(args, 0, sizeof(*args));
+		args->cb = &ping;
+		args->echo = &pong;
+		args->count = opt->messages;
+		args->cpu = opt->cpus.count ? (int)opt->cpus.values[i % opt->cpus.count] : -1;
+		args->start = &start;
+		pthread_create(&threads[i], NULL, i == 0 ? bench_ping : bench_pong, args);
+	}
+
+	pthread_barrier_wait(&start);
+	uint64_t t0 = now_ns();
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+	uint64_t t1 = now_ns();
+
+	res->hist = thread_args[0].hist;
+	res->stride = ping.stride;
+	res->seconds = (double)(t1 - t0) / 1e9;
+	res->mmsgs = (double)opt->messages / res->seconds / 1e6;
+
+	pthread_barrier_destroy(&start);
+	cb_free(&ping);
+	cb_free(&pong);
+	return (0);
+}
+
+static int valid_combo(const CircularBufferConfig *cfg, uint32_t producers, uint32_t consumers)
+{
+	CbMode mode = cfg->mode;
+
+	if ((cfg->flags & CB_FLAG_FAA) && mode != CB_MPMC)
+		return (0);
+	if (cfg->publish_interval > 1 && (mode != CB_SPSC || cfg->publish_interval > cfg->capacity))
+		return (0);
+	if (cfg->prefetch_distance >= cfg->capacity)
+		return (0);
+	if (producers == 0 || consumers == 0 || producers > MAX_THREADS || consumers > MAX_THREADS)
+		return (0);
+	if (!(mode & CB_MPSC) && producers != 1)
+		return (0);
+	if (!(mode & CB_SPMC) && consumers != 1)
+		return (0);
+	return (1);
+}
+
+/* -- Output -- */
+
+static void print_header(const Options *opt)
+{
+	if (strcmp(opt->format, "csv") == 0)
+		printf("test,mode,engine,publish,prefetch,capacity,slot_size,stride,layout,backoff,producers,consumers,batch,rate,seq_bits,"
+			"messages,seconds,mmsgs,p50_ns,p99_ns,p999_ns,max_ns\n");
+	else if (strcmp(opt->format, "json") == 0)
+		printf("[");
+	else
+	{
+		printf("Test:      %s, latency %s\n", opt->test,
+			strcmp(opt->test, "pingpong") == 0 ? "round trip" : "one way");
+		printf("Positions: %d-bit (build with -DCIRCBUF_SEQ64 to compare), %u messages per run\n\n",
+			(int)sizeof(cb_seq_t) * 8, opt->messages);
+		printf("%-5s %-6s %7s %8s %8s %5s %6s %-8s %-6s %3s %3s %5s %9s %9s %8s %8s %8s %10s\n", "mode", "engine", "publish", "prefetch", "capacity",
+			"size", "stride", "layout", "backoff", "P", "C", "batch", "rate", "M msg/s",
+			"p50 ns", "p99 ns", "p999 ns", "max ns");
+	}
+}
+
+static void print_row(const Options *opt, const RunSpec *spec, const RunResult *res, int first)
+{
+	const char	*mode = mode_names[spec->cfg.mode];
+	const char	*layout = layout_names[spec->cfg.layout];
+	const char	*backoff = backoff_names[spec->cfg.backoff];
+	const char	*engine = engine_names[(spec->cfg.flags & CB_FLAG_FAA) != 0];
+	uint64_t	p50 = ticks_to_ns(hist_percentile(&res->hist, 50.0));
+	uint64_t	p99 = ticks_to_ns(hist_percentile(&res->hist, 99.0));
+	uint64_t	p999 = ticks_to_ns(hist_percentile(&res->hist, 99.9));
+	uint64_t	max = ticks_to_ns(res->hist.max);
+
+	if (strcmp(opt->format, "csv") == 0)
+		printf("%s,%s,%s,%u,%u,%u,%u,%u,%s,%s,%u,%u,%u,%u,%d,%u,%.6f,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+			opt->test, mode, engine, spec->cfg.publish_interval, spec->cfg.prefetch_distance, spec->cfg.capacity, spec->cfg.slot_size, res->stride, layout, backoff,
+			spec->producers, spec->consumers, spec->batch, spec->rate, (int)sizeof(cb_seq_t) * 8,
+			opt->messages, res->seconds, res->mmsgs, p50, p99, p999, max);
+	else if (strcmp(opt->format, "json") == 0)
+		printf("%s\n  {\"test\":\"%s\",\"mode\":\"%s\",\"engine\":\"%s\",\"publish\":%u,\"prefetch\":%u,\"capacity\":%u,"
+			"\"slot_size\":%u,\"stride\":%u,"
+			"\"layout\":\"%s\",\"backoff\":\"%s\",\"producers\":%u,\"consumers\":%u,\"batch\":%u,"
+			"\"rate\":%u,\"seq_bits\":%d,\"messages\":%u,\"seconds\":%.6f,\"mmsgs\":%.3f,"
+			"\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}",
+			first ? "" : ",", opt->test, mode, engine, spec->cfg.publish_interval, spec->cfg.prefetch_distance, spec->cfg.capacity, spec->cfg.slot_size, res->stride,
+			layout, backoff, spec->producers, spec->consumers, spec->batch, spec->rate,
+			(int)sizeof(cb_seq_t) * 8, opt->messages, res->seconds, res->mmsgs, p50, p99, p999, max);
+	else
+		printf("%-5s %-6s %7u %8u %8u %5u %6u %-8s %-6s %3u %3u %5u %9u %9.2f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10" PRIu64 "\n",
+			mode, engine, spec->cfg.publish_interval, spec->cfg.prefetch_distance, spec->cfg.capacity, spec->cfg.slot_size, res->stride, layout, backoff,
+			spec->producers, spec->consumers, spec->batch, spec->rate, res->mmsgs, p50, p99, p999, max);
+}
+
+static void print_footer(const Options *opt)
+{
+	if (strcmp(opt->format, "json") == 0)
+		printf("\n]\n");
+}
+
+/* -- Argument parsing -- */
+
+static int parse_list(const char *arg, List *list, const char **names, uint32_t name_count)
+{
+	char	buf[512];
+	char	*save = NULL;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	list->count = 0;
+	for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+	{
+		uint32_t i = 0;
+
+		if (list->count == MAX_LIST)
+			return (-1);
+		if (!names)
+		{
+			list->values[list->count++] = (uint32_t)strtoul(tok, NULL, 0);
+			continue;
+		}
+		while (i < name_count && strcmp(tok, names[i]) != 0)
+			++i;
+		if (i == name_count)
+			return (-1);
+		list->values[list->count++] = i;
+	}
+	return (list->count ? 0 : -1);
+}
+
+static int read_topology(int cpu, const char *field)
+{
+	char	path[128];
+	FILE	*f;
+	int		v = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, field);
+	f = fopen(path, "r");
+	if (!f)
+		return (-1);
+	if (fscanf(f, "%d", &v) != 1)
+		v = -1;
+	fclose(f);
+	return (v);
+}
+
+/* "smt" pairs cpu0 with another hardware thread of the same core, "cross"
+   with the first cpu in a different physical package. */
+static int parse_cpus(const char *arg, List *list)
+{
+	int smt = strcmp(arg, "smt") == 0;
+
+	if (!smt && strcmp(arg, "cross") != 0)
+		return (parse_list(arg, list, NULL, 0));
+
+	int ncpu = (int)sysconf(_SC_NPROCESSORS_CONF);
+	int pkg0 = read_topology(0, "physical_package_id");
+	int core0 = read_topology(0, "core_id");
+
+	for (int cpu = 1; cpu < ncpu; ++cpu)
+	{
+		int pkg = read_topology(cpu, "physical_package_id");
+		int core = read_topology(cpu, "core_id");
+
+		if (pkg < 0)
+			continue;
+		if ((smt && pkg == pkg0 && core == core0) || (!smt && pkg != pkg0))
+		{
+			list->values[0] = 0;
+			list->values[1] = (uint32_t)cpu;
+			list->count = 2;
+			return (0);
+		}
+	}
+	fprintf(stderr, "no cpu pair found for -C %s\n", arg);
+	return (-1);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t stream|pingpong] [-m modes] [-c capacities] [-s slot_sizes]\n"
+		"       [-p producers] [-q consumers] [-b batches] [-l layouts] [-k backoffs] [-e engines]\n"
+		"       [-P publish_intervals] [-F prefetch_distances] [-n messages] [-r repetitions] [-R rates]\n"
+		"       [-L sample_every] [-a malloc|mmap|huge] [-C cpus|smt|cross] [-f table|csv|json]\n", prog);
+}
+
+static int parse_options(int argc, char **argv, Options *opt)
+{
+	int c;
+
+	memset(opt, 0, sizeof(*opt));
+	parse_list("spsc,mpmc", &opt->modes, mode_names, 4);
+	parse_list("1024", &opt->capacities, NULL, 0);
+	parse_list("16", &opt->slot_sizes, NULL, 0);
+	parse_list("1,4", &opt->producers, NULL, 0);
+	parse_list("1,4", &opt->consumers, NULL, 0);
+	parse_list("1", &opt->batches, NULL, 0);
+	parse_list("packed", &opt->layouts, layout_names, 3);
+	parse_list("none", &opt->backoffs, backoff_names, 4);
+	parse_list("cas", &opt->engines, engine_names, 2);
+	parse_list("0", &opt->publishes, NULL, 0);
+	parse_list("0", &opt->prefetches, NULL, 0);
+	parse_list("0", &opt->rates, NULL, 0);
+	opt->messages = 4000000;
+	opt->repetitions = 1;
+	opt->sample_every = 64;
+	opt->allocator = "malloc";
+	opt->format = "table";
+	opt->test = "stream";
+
+	while ((c = getopt(argc, argv, "t:m:c:s:p:q:b:l:k:e:P:F:n:r:R:L:a:C:f:h")) != -1)
+	{
+		int err = 0;
+
+		switch (c)
+		{
+			case 't': opt->test = optarg; break;
+			case 'm': err = parse_list(optarg, &opt->modes, mode_names, 4); break;
+			case 'c': err = parse_list(optarg, &opt->capacities, NULL, 0); break;
+			case 's': err = parse_list(optarg, &opt->slot_sizes, NULL, 0); break;
+			case 'p': err = parse_list(optarg, &opt->producers, NULL, 0); break;
+			case 'q': err = parse_list(optarg, &opt->consumers, NULL, 0); break;
+			case 'b': err = parse_list(optarg, &opt->batches, NULL, 0); break;
+			case 'l': err = parse_list(optarg, &opt->layouts, layout_names, 3); break;
+			case 'k': err = parse_list(optarg, &opt->backoffs, backoff_names, 4); break;
+			case 'e': err = parse_list(optarg, &opt->engines, engine_names, 2); break;
+			case 'P': err = parse_list(optarg, &opt->publishes, NULL, 0); break;
+			case 'F': err = parse_list(optarg, &opt->prefetches, NULL, 0); break;
+			case 'n': opt->messages = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'r': opt->repetitions = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'R': err = parse_list(optarg, &opt->rates, NULL, 0); break;
+			case 'L': opt->sample_every = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'a': opt->allocator = optarg; break;
+			case 'C': err = parse_cpus(optarg, &opt->cpus); break;
+			case 'f': opt->format = optarg; break;
+			default: err = -1; break;
+		}
+		if (err != 0)
+		{
+			usage(argv[0]);
+			return (-1);
+		}
+	}
+	if (strcmp(opt->test, "pingpong") == 0)
+	{
+		// One thread at each end, one message in flight
+		parse_list("1", &opt->producers, NULL, 0);
+		parse_list("1", &opt->consumers, NULL, 0);
+		parse_list("1", &opt->batches, NULL, 0);
+		parse_list("0", &opt->publishes, NULL, 0);
+		parse_list("0", &opt->prefetches, NULL, 0);
+		parse_list("0", &opt->rates, NULL, 0);
+	}
+	else if (strcmp(opt->test, "stream") != 0)
+	{
+		usage(argv[0]);
+		return (-1);
+	}
+	return (0);
+}
+
+int main(int argc, char **argv)
+{
+	Options	opt;
+	int		first = 1;
+
+	if (parse_options(argc, argv, &opt) != 0)
+		return (1);
+
+	calibrate_ticks();
+	print_header(&opt);
+	for (uint32_t m = 0; m < opt.modes.count; ++m)
+	for (uint32_t c = 0; c < opt.capacities.count; ++c)
+	for (uint32_t s = 0; s < opt.slot_sizes.count; ++s)
+	for (uint32_t l = 0; l < opt.layouts.count; ++l)
+	for (uint32_t k = 0; k < opt.backoffs.count; ++k)
+	for (uint32_t e = 0; e < opt.engines.count; ++e)
+	for (uint32_t w = 0; w < opt.publishes.count; ++w)
+	for (uint32_t d = 0; d < opt.prefetches.count; ++d)
+	for (uint32_t p = 0; p < opt.producers.count; ++p)
+	for (uint32_t q = 0; q < opt.consumers.count; ++q)
+	for (uint32_t b = 0; b < opt.batches.count; ++b)
+	for (uint32_t t = 0; t < opt.rates.count; ++t)
+	{
+		uint32_t	slot_size = opt.slot_sizes.values[s];
+		RunSpec		spec = {
+			.cfg = {
+				.capacity = opt.capacities.values[c],
+				.slot_size = slot_size < sizeof(BenchHeader) ? (uint32_t)sizeof(BenchHeader) : slot_size,
+				.layout = (CbLayout)opt.layouts.values[l],
+				.mode = (CbMode)opt.modes.values[m],
+				.backoff = (CbBackoff)opt.backoffs.values[k],
+				.flags = opt.engines.values[e] ? CB_FLAG_FAA : 0,
+				.publish_interval = opt.publishes.values[w],
+				.prefetch_distance = opt.prefetches.values[d],
+			},
+			.producers = opt.producers.values[p],
+			.consumers = opt.consumers.values[q],
+			.batch = opt.batches.values[b] ? opt.batches.values[b] : 1,
+			.rate = opt.rates.values[t],
+		};
+
+		if (!valid_combo(&spec.cfg, spec.producers, spec.consumers))
+			continue;
+		for (uint32_t r = 0; r < opt.repetitions; ++r)
+		{
+			RunResult	res;
+			int			err = strcmp(opt.test, "pingpong") == 0
+				? run_pingpong(&opt, &spec, &res) : run(&opt, &spec, &res);
+
+			if (err != 0)
+			{
+				fprintf(stderr, "cb_init_ex failed (capacity %u, slot_size %u)\n",
+					spec.cfg.capacity, spec.cfg.slot_size);
+				return (1);
+			}
+			print_row(&opt, &spec, &res, first);
+			fflush(stdout);
+			first = 0;
+		}
+	}
+	print_footer(&opt);
+	return (0);
+}
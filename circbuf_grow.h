@@ -0,0 +1,247 @@
+#ifndef CIRCBUF_GROW_H
+# define CIRCBUF_GROW_H
+
+#include "circbuf.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* -- Growable ring --
+   An SPSC queue made of a chain of CircularBuffer segments. When the
+   producer's segment is full it allocates one twice as large (up to
+   max_capacity), links it behind the current one and carries on there;
+   the consumer drains the old segment first, then follows the link and
+   frees what it left behind. Neither side ever waits for the other, and
+   no slot is ever copied: the segments are never resized in place, which
+   is why the Allocator's realloc hook is not used (it would move a slot
+   array the other side is still reading).
+
+   Shrinking uses the same chaining. Every CB_GROW_CHECK pushes the
+   producer samples its segment's occupancy; once it has stayed at or
+   below a quarter of the segment for shrink_after pushes, the producer
+   chains a segment half the size (never below the initial capacity).
+   shrink_after = 0 keeps the largest segment for good.
+
+   SPSC only, like the byte ring: with several producers a late claim
+   could land in a segment the consumers have already left, and with
+   several consumers retired segments would need deferred reclamation.
+   One outstanding claim per side: publish/release before claiming the
+   next slot. */
+
+# ifndef CB_GROW_CHECK
+#  define CB_GROW_CHECK 64	// pushes between occupancy samples, a power of two
+# endif
+
+typedef struct CbGrowSeg {
+	CircularBuffer				cb;
+	_Atomic(struct CbGrowSeg *)	next;	// Set by the producer after its last publish here
+} CbGrowSeg;
+
+typedef struct {
+	uint32_t	capacity;		// initial and minimum segment capacity
+	uint32_t	max_capacity;	// largest segment; full beyond that
+	uint32_t	slot_size;
+	CbLayout	layout;
+	uint32_t	shrink_after;	// low-occupancy pushes before shrinking, 0 = never
+} CbGrowConfig;
+
+typedef struct {
+	Allocator						alloc;
+	CbGrowConfig					cfg;
+	_Atomic uint32_t				segments;	// live segments, for monitoring
+	_Alignas(64) CbGrowSeg			*prod;		// producer-local
+	uint64_t						pushes;		// producer-local
+	uint64_t						quiet;		// producer-local: pushes at low occupancy
+	uint32_t						grows;		// producer-local
+	uint32_t						shrinks;	// producer-local
+	_Alignas(64) CbGrowSeg			*cons;		// consumer-local
+} CircularGrowBuffer;
+
+static inline CbGrowSeg	*cbg_seg_new(CircularGrowBuffer *g, uint32_t capacity)
+{
+	CircularBufferConfig cfg = {
+		.capacity = capacity,
+		.slot_size = g->cfg.slot_size,
+		.layout = g->cfg.layout,
+		.mode = CB_SPSC,
+	};
+	CbGrowSeg *seg = g->alloc.alloc(g->alloc.ctx, sizeof(CbGrowSeg), CIRCBUF_CACHE_LINE);
+
+	if (!seg)
+		return (NULL);
+	if (cb_init_ex(&seg->cb, g->alloc, &cfg) != 0)
+	{
+		if (g->alloc.free)
+			g->alloc.free(g->alloc.ctx, seg);
+		return (NULL);
+	}
+	atomic_init(&seg->next, NULL);
+	atomic_fetch_add_explicit(&g->segments, 1, memory_order_relaxed);
+	return (seg);
+}
+
+static inline void	cbg_seg_free(CircularGrowBuffer *g, CbGrowSeg *seg)
+{
+	cb_free(&seg->cb);
+	if (g->alloc.free)
+		g->alloc.free(g->alloc.ctx, seg);
+	atomic_fetch_sub_explicit(&g->segments, 1, memory_order_relaxed);
+}
+
+static inline int	cbg_init(CircularGrowBuffer *g, Allocator alloc, const CbGrowConfig *cfg)
+{
+	assert(g != NULL && "g is NULL");
+	assert(cfg != NULL && "cfg is NULL");
+	assert(alloc.alloc != NULL && "allocator must provide alloc function");
+	assert(cfg->capacity >= 2 && (cfg->capacity & (cfg->capacity - 1)) == 0
+			&& "capacity must be a power of two");
+	assert(cfg->max_capacity >= cfg->capacity && (cfg->max_capacity & (cfg->max_capacity - 1)) == 0
+			&& "max_capacity must be a power of two >= capacity");
+
+	if (!g || !cfg || !alloc.alloc || cfg->capacity < 2 || (cfg->capacity & (cfg->capacity - 1)) != 0
+			|| cfg->max_capacity < cfg->capacity || (cfg->max_capacity & (cfg->max_capacity - 1)) != 0
+			|| cfg->slot_size == 0)
+		return (-EINVAL);
+
+	g->alloc = alloc;
+	g->cfg = *cfg;
+	atomic_init(&g->segments, 0);
+	g->pushes = 0;
+	g->quiet = 0;
+	g->grows = 0;
+	g->shrinks = 0;
+	g->prod = cbg_seg_new(g, cfg->capacity);
+	g->cons = g->prod;
+	return (g->prod ? 0 : -ENOMEM);
+}
+
+static inline void	cbg_free(CircularGrowBuffer *g)
+{
+	if (!g || !g->cons)
+		return;
+	while (g->cons)
+	{
+		CbGrowSeg *next = atomic_load_explicit(&g->cons->next, memory_order_relaxed);
+		cbg_seg_free(g, g->cons);
+		g->cons = next;
+	}
+	g->prod = NULL;
+}
+
+/* Moves the producer to a fresh segment of the given capacity. Everything
+   in the old one is already published, so the release store of next is
+   what tells the consumer the old segment is finished. */
+static inline int	cbg_chain(CircularGrowBuffer *g, uint32_t capacity)
+{
+	CbGrowSeg *seg = cbg_seg_new(g, capacity);
+
+	if (!seg)
+		return (0);
+	atomic_store_explicit(&g->prod->next, seg, memory_order_release);
+	g->prod = seg;
+	g->quiet = 0;
+	return (1);
+}
+
+static inline void	cbg_maybe_shrink(CircularGrowBuffer *g)
+{
+	uint32_t capacity = g->prod->cb.mask + 1;
+
+	if (g->cfg.shrink_after == 0 || capacity == g->cfg.capacity
+			|| (++g->pushes & (CB_GROW_CHECK - 1)) != 0)
+		return;
+	if (cb_size_approx(&g->prod->cb) > capacity / 4)
+	{
+		g->quiet = 0;
+		return;
+	}
+	g->quiet += CB_GROW_CHECK;
+	if (g->quiet >= g->cfg.shrink_after && cbg_chain(g, capacity / 2))
+		g->shrinks++;
+}
+
+/* Returns a slot to fill and publish with cbg_push_publish, or NULL when
+   the largest segment is full (or a new one could not be allocated). */
+static inline void	*cbg_push_claim(CircularGrowBuffer *g, cb_seq_t *out_pos)
+{
+	assert(g != NULL && "g is NULL");
+
+	void *data = cb_push_claim(&g->prod->cb, out_pos);
+
+	if (data)
+		return (data);
+	uint32_t capacity = g->prod->cb.mask + 1;
+	if (capacity >= g->cfg.max_capacity || !cbg_chain(g, capacity * 2))
+		return (NULL); // Full
+	g->grows++;
+	return (cb_push_claim(&g->prod->cb, out_pos));
+}
+
+static inline void	cbg_push_publish(CircularGrowBuffer *g, cb_seq_t pos)
+{
+	assert(g != NULL && "g is NULL");
+	cb_push_publish(&g->prod->cb, pos);
+	cbg_maybe_shrink(g); // Only here: every claim in the old segment is now published
+}
+
+/* Returns the oldest slot, to be released with cbg_pop_release, or NULL
+   if the queue is empty. Frees segments the producer has moved past. */
+static inline void	*cbg_pop_claim(CircularGrowBuffer *g, cb_seq_t *out_pos)
+{
+	assert(g != NULL && "g is NULL");
+
+	for (;;)
+	{
+		void *data = cb_pop_claim(&g->cons->cb, out_pos);
+		if (data)
+			return (data);
+
+		CbGrowSeg *next = atomic_load_explicit(&g->cons->next, memory_order_acquire);
+		if (!next)
+			return (NULL); // Empty
+		/* The producer's last publishes here happen-before next; look once
+		   more before leaving the segment for good. */
+		data = cb_pop_claim(&g->cons->cb, out_pos);
+		if (data)
+			return (data);
+		cbg_seg_free(g, g->cons);
+		g->cons = next;
+	}
+}
+
+static inline void	cbg_pop_release(CircularGrowBuffer *g, cb_seq_t pos)
+{
+	assert(g != NULL && "g is NULL");
+	cb_pop_release(&g->cons->cb, pos);
+}
+
+/* Copying wrappers: 0 on success, -1 when full/empty. */
+static inline int	cbg_push(CircularGrowBuffer *g, const void *data, uint32_t size)
+{
+	assert(size <= g->cfg.slot_size && "size exceeds slot_size");
+
+	cb_seq_t	pos;
+	void		*slot = cbg_push_claim(g, &pos);
+
+	if (!slot)
+		return (-1);
+	memcpy(slot, data, size);
+	cbg_push_publish(g, pos);
+	return (0);
+}
+
+static inline int	cbg_pop(CircularGrowBuffer *g, void *data, uint32_t size)
+{
+	assert(size <= g->cfg.slot_size && "size exceeds slot_size");
+
+	cb_seq_t	pos;
+	void		*slot = cbg_pop_claim(g, &pos);
+
+	if (!slot)
+		return (-1);
+	memcpy(data, slot, size);
+	cbg_pop_release(g, pos);
+	return (0);
+}
+
+#endif // CIRCBUF_GROW_H
@@ -0,0 +1,218 @@
+#ifndef CIRCBUF_IO_H
+# define CIRCBUF_IO_H
+
+// recvmmsg, sendmmsg and struct mmsghdr are GNU extensions; see below
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# error "circbuf_io.h needs _GNU_SOURCE defined before any system header"
+#endif
+
+#include "circbuf.h"
+
+#ifdef __linux__
+# include <errno.h>
+# include <stddef.h>
+# include <sys/socket.h>
+# include <sys/uio.h>
+# include <unistd.h>
+
+/* -- Scatter-gather I/O --
+   The kernel reads into and writes from slots directly, with no staging
+   copy. Fixed-slot rings carry one datagram per slot, framed as a
+   CbDatagram (length, then payload), so slot_size must cover the length
+   word plus the largest datagram; longer ones are truncated. The push
+   helpers need a single producer (SPSC/SPMC) and the pop helpers a
+   single consumer (SPSC/MPSC), because slots the kernel did not fill are
+   handed back with cb_*_unclaim_n. Byte streams go through the
+   variable-length ring, where each read becomes one record of exactly
+   the bytes returned.
+
+   All helpers return the number of datagrams/bytes moved, or -errno;
+   -ENOBUFS means the ring was full (push) or empty (pop).
+
+   Needs _GNU_SOURCE for the mmsg calls. It is not defined here: it
+   changes what every later system header declares, so the translation
+   unit opts in itself, with #define _GNU_SOURCE above its first #include
+   or -D_GNU_SOURCE. */
+
+# ifndef CB_IO_MAX_BATCH
+#  define CB_IO_MAX_BATCH 64	// slots per recvmmsg / sendmmsg call
+# endif
+
+typedef struct {
+	uint32_t	len;
+	uint8_t		data[];
+} CbDatagram;
+
+/* One iovec per slot of the claimed range [pos, pos + count), covering
+   len bytes from offset into each slot's data. */
+static inline void	cb_io_iov(CircularBuffer *cb, cb_seq_t pos, uint32_t count, uint32_t offset,
+	uint32_t len, struct iovec *iov)
+{
+	assert(offset + len <= cb->slot_size && "iovec exceeds slot_size");
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		iov[i].iov_base = (uint8_t *)cb_slot_data(cb, pos + i) + offset;
+		iov[i].iov_len = len;
+	}
+}
+
+static inline int	cb_recvmmsg(CircularBuffer *cb, int fd, uint32_t max, int flags)
+{
+	struct mmsghdr	msgs[CB_IO_MAX_BATCH];
+	struct iovec	iov[CB_IO_MAX_BATCH];
+	uint32_t		cap = cb->slot_size - (uint32_t)offsetof(CbDatagram, data);
+	cb_seq_t		pos;
+
+	assert(cb->slot_size > offsetof(CbDatagram, data) && "slot_size too small for a CbDatagram");
+
+	uint32_t n = cb_push_claim_n(cb, max < CB_IO_MAX_BATCH ? max : CB_IO_MAX_BATCH, &pos);
+	if (n == 0)
+		return (-ENOBUFS);
+
+	cb_io_iov(cb, pos, n, (uint32_t)offsetof(CbDatagram, data), cap, iov);
+	memset(msgs, 0, n * sizeof(msgs[0]));
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int r = recvmmsg(fd, msgs, n, flags, NULL);
+	if (r < 0)
+	{
+		int err = -errno;
+		cb_push_unclaim_n(cb, pos, n);
+		return (err);
+	}
+	for (int i = 0; i < r; ++i)
+	{
+		CbDatagram *dg = (CbDatagram *)cb_slot_data(cb, pos + i);
+		dg->len = msgs[i].msg_len < cap ? msgs[i].msg_len : cap;
+	}
+	cb_push_unclaim_n(cb, pos + r, n - r);
+	cb_push_publish_n(cb, pos, r);
+	return (r);
+}
+
+static inline int	cb_sendmmsg(CircularBuffer *cb, int fd, uint32_t max, int flags)
+{
+	struct mmsghdr	msgs[CB_IO_MAX_BATCH];
+	struct iovec	iov[CB_IO_MAX_BATCH];
+	cb_seq_t		pos;
+
+	uint32_t n = cb_pop_claim_n(cb, max < CB_IO_MAX_BATCH ? max : CB_IO_MAX_BATCH, &pos);
+	if (n == 0)
+		return (-ENOBUFS);
+
+	memset(msgs, 0, n * sizeof(msgs[0]));
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		CbDatagram *dg = (CbDatagram *)cb_slot_data(cb, pos + i);
+
+		iov[i].iov_base = dg->data;
+		iov[i].iov_len = dg->len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int r = sendmmsg(fd, msgs, n, flags);
+	if (r < 0)
+	{
+		int err = -errno;
+		cb_pop_unclaim_n(cb, pos, n);
+		return (err);
+	}
+	cb_pop_unclaim_n(cb, pos + r, n - r);
+	cb_pop_release_n(cb, pos, r);
+	return (r);
+}
+
+/* Reads up to max_size bytes straight into a new record; publishes what
+   the kernel returned, nothing on EOF (returns 0) or error. */
+static inline int	cbb_read(CircularByteBuffer *cbb, int fd, uint32_t max_size)
+{
+	cb_seq_t	pos;
+	void		*data = cbb_push_claim(cbb, max_size, &pos);
+
+	if (!data)
+		return (-ENOBUFS);
+
+	ssize_t r = read(fd, data, max_size);
+	if (r <= 0)
+	{
+		int err = r < 0 ? -errno : 0;
+		cbb_push_cancel(cbb, pos);
+		return (err);
+	}
+	cbb_push_publish_size(cbb, pos, (uint32_t)r);
+	return ((int)r);
+}
+
+/* recv(2) into a new record. A datagram socket publishes every datagram,
+   empty ones included; on a stream socket a 0 return is EOF and, as in
+   cbb_read, publishes nothing. */
+static inline int	cbb_recv(CircularByteBuffer *cbb, int fd, uint32_t max_size, int flags)
+{
+	cb_seq_t	pos;
+	void		*data = cbb_push_claim(cbb, max_size, &pos);
+
+	if (!data)
+		return (-ENOBUFS);
+
+	ssize_t r = recv(fd, data, max_size, flags);
+	if (r < 0)
+	{
+		int err = -errno;
+		cbb_push_cancel(cbb, pos);
+		return (err);
+	}
+	if (r == 0)
+	{
+		int			type = 0;
+		socklen_t	len = sizeof(type);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM)
+		{
+			cbb_push_cancel(cbb, pos);
+			return (0);
+		}
+	}
+	cbb_push_publish_size(cbb, pos, (uint32_t)r);
+	return ((int)r);
+}
+
+/* Writes the oldest record with a single write(2), starting *offset
+   bytes in. A short write advances *offset and leaves the record queued;
+   the record is released, and *offset reset to 0, once fully written.
+   Start with *offset = 0 and keep it per ring. */
+static inline int	cbb_write(CircularByteBuffer *cbb, int fd, uint32_t *offset)
+{
+	cb_seq_t	pos;
+	uint32_t	size;
+	uint8_t		*data = cbb_pop_claim(cbb, &size, &pos);
+
+	if (!data)
+		return (-ENOBUFS);
+	assert(*offset <= size && "offset past the record");
+
+	ssize_t r = size > *offset ? write(fd, data + *offset, size - *offset) : 0;
+	if (r < 0)
+	{
+		int err = -errno;
+		cbb_pop_unclaim(cbb, pos); // Still queued
+		return (err);
+	}
+	*offset += (uint32_t)r;
+	if (*offset < size)
+	{
+		cbb_pop_unclaim(cbb, pos);
+		return ((int)r);
+	}
+	*offset = 0;
+	cbb_pop_release(cbb, pos);
+	return ((int)r);
+}
+
+#endif // __linux__
+#endif // CIRCBUF_IO_H
@@ -0,0 +1,208 @@
+#ifndef CIRCBUF_JOURNAL_H
+# define CIRCBUF_JOURNAL_H
+
+#include "circbuf_shm.h"
+
+#ifdef __linux__
+
+/* -- Journal ring --
+   A ring in a regular file, laid out as a shm segment (circbuf_shm.h),
+   that a restarted consumer can replay instead of losing what was in
+   flight. The buffer runs with CB_FLAG_JOURNAL, so the slots themselves
+   record which positions were published; the consumer commits its
+   position into the header just before each release. Opening an existing
+   file rebuilds the ring from the last commit with cb_recover: everything
+   published but not committed is delivered again (at least once), and a
+   slot a producer claimed but never published ends the replay.
+
+   After a process crash that is exact: the page cache keeps every store.
+   After power loss only what reached the disk counts. Each flush_interval
+   committed positions the consumer starts write-back of the file with
+   sync_file_range(2), which needs _GNU_SOURCE; without it the kick is an
+   msync(MS_ASYNC), which Linux treats as a no-op. Either way only
+   cbj_flush(j, 1) waits until the data is durable. CB_JOURNAL_DAX maps the
+   file MAP_SYNC instead (persistent memory on a DAX filesystem), where
+   plain stores are durable once they leave the cache.
+
+   One consumer (CB_SPSC or CB_MPSC), which alone calls cbj_pop_release_n.
+   cbj_open rewrites the ring when it replays, so the owning process opens
+   the file before anyone else, and producers in other processes join
+   with cbj_attach afterwards. A crash while the file is being created
+   leaves a file cbj_open rejects with -EAGAIN; remove it with cbj_unlink. */
+
+# define CB_JOURNAL_DAX	1u
+
+typedef struct {
+	CbShm		map;
+	int			fd;				// kept open for sync_file_range
+	uint32_t	flush_interval;	// committed positions per write-back kick, 0 = only cbj_flush
+	cb_seq_t	flushed;		// consumer-local: commit at the last kick
+} CbJournal;
+
+static inline int	cbj_map_flags(uint32_t flags)
+{
+	if (!(flags & CB_JOURNAL_DAX))
+		return (MAP_SHARED);
+#ifdef MAP_SYNC
+	return (MAP_SHARED_VALIDATE | MAP_SYNC);
+#else
+	return (-1);
+#endif
+}
+
+/* Opens path, creating it for cfg if it does not exist. Returns the
+   number of positions replayed from an existing file (0 for a new one),
+   or -errno: -EPROTO when the file holds a ring of another layout or
+   shape, -EOPNOTSUPP when CB_JOURNAL_DAX is not available. */
+static inline int	cbj_open(CbJournal *j, const char *path, const CircularBufferConfig *cfg,
+	uint32_t flush_interval, uint32_t flags)
+{
+	assert(j != NULL && path != NULL && cfg != NULL && "j, path and cfg are required");
+	assert(!(cfg->mode & CB_SPMC) && "journal rings need a single consumer");
+	if (!j || !path || !cfg || (cfg->mode & CB_SPMC) || (cfg->flags & CB_FLAG_MIRRORED) || cfg->on_watermark)
+		return (-EINVAL);
+
+	int map_flags = cbj_map_flags(flags);
+	if (map_flags < 0)
+		return (-EOPNOTSUPP);
+
+	CircularBufferConfig	journal = *cfg;
+	int						fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	int						err;
+
+	journal.flags |= CB_FLAG_JOURNAL;
+	j->flush_interval = flush_interval;
+	j->flushed = 0;
+	j->fd = fd;
+	if (fd >= 0)
+	{
+		err = cb_shm_init_fd(&j->map, fd, &journal, map_flags);
+		if (err != 0)
+		{
+			close(fd);
+			unlink(path);
+			j->fd = -1;
+		}
+		return (err);
+	}
+	if (errno != EEXIST || (fd = open(path, O_RDWR)) < 0)
+		return (-errno);
+	err = cb_shm_map_fd(&j->map, fd, map_flags);
+	if (err != 0)
+	{
+		close(fd);
+		return (err);
+	}
+	j->fd = fd;
+
+	CircularBuffer *cb = j->map.cb;
+
+	if (cb->mask + 1 != cfg->capacity || cb->slot_size != cfg->slot_size
+			|| cb->mode != cfg->mode || !(cb->flags & CB_FLAG_JOURNAL))
+	{
+		cb_shm_detach(&j->map);
+		close(fd);
+		return (-EPROTO);
+	}
+	j->flushed = atomic_load_explicit(&j->map.seg->commit, memory_order_relaxed);
+	return ((int)cb_recover(cb, j->flushed));
+}
+
+/* Maps a journal another process has opened, without replaying it. */
+static inline int	cbj_attach(CbJournal *j, const char *path, uint32_t flags)
+{
+	assert(j != NULL && path != NULL && "j and path are required");
+	if (!j || !path)
+		return (-EINVAL);
+
+	int map_flags = cbj_map_flags(flags);
+	if (map_flags < 0)
+		return (-EOPNOTSUPP);
+
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return (-errno);
+
+	int err = cb_shm_map_fd(&j->map, fd, map_flags);
+
+	if (err == 0 && !(j->map.cb->flags & CB_FLAG_JOURNAL))
+	{
+		cb_shm_detach(&j->map);
+		err = -EPROTO;
+	}
+	if (err != 0)
+		close(fd);
+	j->fd = err == 0 ? fd : -1;
+	j->flush_interval = 0;
+	j->flushed = 0;
+	return (err);
+}
+
+static inline CircularBuffer	*cbj_ring(CbJournal *j)
+{
+	return (j->map.cb);
+}
+
+/* Waits for everything written so far to reach the disk (sync), or only
+   starts the write-back, which bounds nothing on its own (see above).
+   Returns 0 or -errno. */
+static inline int	cbj_flush(CbJournal *j, int sync)
+{
+	assert(j != NULL && j->map.seg != NULL && "journal is not open");
+
+	j->flushed = atomic_load_explicit(&j->map.seg->commit, memory_order_relaxed);
+#if defined(_GNU_SOURCE) && defined(SYNC_FILE_RANGE_WRITE)
+	if (!sync)
+		return (sync_file_range(j->fd, 0, (off_t)j->map.size, SYNC_FILE_RANGE_WRITE) == 0 ? 0 : -errno);
+#endif
+	if (msync(j->map.seg, j->map.size, sync ? MS_SYNC : MS_ASYNC) != 0)
+		return (-errno);
+	return (0);
+}
+
+/* Consumer: commits pos + count, then releases the slots. Use instead of
+   cb_pop_release_n; a release without a commit is replayed after a
+   restart. */
+static inline void	cbj_pop_release_n(CbJournal *j, cb_seq_t pos, uint32_t count)
+{
+	assert(j != NULL && j->map.seg != NULL && "journal is not open");
+
+	// The commit must be stored before producers can reuse the slots
+	atomic_store_explicit(&j->map.seg->commit, pos + count, memory_order_release);
+	cb_pop_release_n(j->map.cb, pos, count);
+	if (j->flush_interval && pos + count - j->flushed >= j->flush_interval)
+		cbj_flush(j, 0);
+}
+
+/* Copying wrapper: 0 on success, -1 when empty. */
+static inline int	cbj_pop(CbJournal *j, void *data, uint32_t size)
+{
+	assert(size <= j->map.cb->slot_size && "size exceeds slot_size");
+
+	cb_seq_t	pos;
+	void		*slot = cb_pop_claim(j->map.cb, &pos);
+
+	if (!slot)
+		return (-1); // Empty
+	memcpy(data, slot, size);
+	cbj_pop_release_n(j, pos, 1);
+	return (0);
+}
+
+/* Unmaps the file; its contents stay for the next cbj_open. */
+static inline void	cbj_close(CbJournal *j)
+{
+	cb_shm_detach(&j->map);
+	if (j->fd >= 0)
+		close(j->fd);
+	j->fd = -1;
+}
+
+static inline int	cbj_unlink(const char *path)
+{
+	return (unlink(path) == 0 ? 0 : -errno);
+}
+
+#endif // __linux__
+
+#endif // CIRCBUF_JOURNAL_H
@@ -0,0 +1,235 @@
+#ifndef CIRCBUF_LANES_H
+# define CIRCBUF_LANES_H
+
+#include "circbuf.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* -- Priority lanes --
+   Up to CB_LANES_MAX rings ("lanes") drained by one consumer in priority
+   order, lane 0 first. All lanes live in one allocation:
+     [CircularBuffer x lanes][lane 0 slots][lane 1 slots]...
+   and share one occupancy word, bit i set when lane i may hold messages.
+   An idle poll is a single load of that word; a busy one picks the lane
+   with a ctz instead of trying every ring in turn.
+
+   Producers set their lane's bit after publishing, and only if it is not
+   set already, so in steady state the shared word stays read-only for
+   them. The consumer clears a bit only when it finds that lane empty,
+   then looks once more, so a message published concurrently is never
+   stranded behind a clear bit.
+
+   Every publish therefore pays a full fence, even when the bit is
+   already set: without it the bit check could pass the publish itself.
+
+   Weights bound how long a lane may hold the consumer: a lane of weight
+   w yields to the lanes after it once it has handed out w messages, until
+   every non-empty lane has used its share and a new round starts. Weight
+   0 never yields (strict priority: lane 0 for cancels keeps jumping
+   ahead of everything behind it for as long as it has messages).
+
+   One consumer thread; each lane is single-producer unless
+   multi_producer is set. */
+
+# define CB_LANES_MAX	64
+
+typedef struct {
+	uint32_t		lanes;			// <= CB_LANES_MAX
+	uint32_t		capacity;		// per lane
+	uint32_t		slot_size;
+	CbLayout		layout;
+	int				multi_producer;	// several producers may share one lane
+	const uint32_t	*weights;		// per lane, NULL = all strict priority
+} CbLaneConfig;
+
+typedef struct {
+	CircularBuffer					*lanes;		// Inside block
+	void							*block;
+	uint32_t						count;
+	Allocator						alloc;
+	uint32_t						weight[CB_LANES_MAX];
+	_Alignas(64) _Atomic uint64_t	occupied;	// bit i: lane i may be non-empty
+	_Alignas(64) uint64_t			credit_mask;	// consumer-local: lanes with credit left this round
+	uint32_t						credit[CB_LANES_MAX];	// consumer-local
+} CircularLaneBuffer;
+
+static inline void	cbl_refill(CircularLaneBuffer *l)
+{
+	for (uint32_t i = 0; i < l->count; ++i)
+		l->credit[i] = l->weight[i];
+	l->credit_mask = l->count == 64 ? ~(uint64_t)0 : ((uint64_t)1 << l->count) - 1;
+}
+
+static inline int	cbl_init(CircularLaneBuffer *l, Allocator alloc, const CbLaneConfig *cfg)
+{
+	assert(l != NULL && "l is NULL");
+	assert(cfg != NULL && "cfg is NULL");
+	assert(alloc.alloc != NULL && "allocator must provide alloc function");
+	assert(cfg->lanes > 0 && cfg->lanes <= CB_LANES_MAX && "lanes must be in [1, CB_LANES_MAX]");
+
+	if (!l || !cfg || !alloc.alloc || cfg->lanes == 0 || cfg->lanes > CB_LANES_MAX)
+		return (-EINVAL);
+
+	CircularBufferConfig lane_cfg = {
+		.capacity = cfg->capacity,
+		.slot_size = cfg->slot_size,
+		.layout = cfg->layout,
+		.mode = cfg->multi_producer ? CB_MPSC : CB_SPSC,
+	};
+	size_t	lanes_size = cb_align_up(cfg->lanes * sizeof(CircularBuffer), CIRCBUF_CACHE_LINE);
+	size_t	slots_size = cb_align_up(cb_slots_size(&lane_cfg), CIRCBUF_CACHE_LINE);
+
+	l->count = cfg->lanes;
+	l->alloc = alloc;
+	l->block = alloc.alloc(alloc.ctx, lanes_size + cfg->lanes * slots_size, CIRCBUF_CACHE_LINE);
+	if (!l->block)
+		return (-ENOMEM);
+	l->lanes = (CircularBuffer *)l->block;
+	for (uint32_t i = 0; i < cfg->lanes; ++i)
+	{
+		Allocator	place = cb_place((uint8_t *)l->block + lanes_size + i * slots_size);
+		int			err = cb_init_ex(&l->lanes[i], place, &lane_cfg);
+
+		if (err != 0)
+		{
+			if (alloc.free)
+				alloc.free(alloc.ctx, l->block);
+			l->block = NULL;
+			return (err);
+		}
+		memset(&l->lanes[i].alloc, 0, sizeof(l->lanes[i].alloc)); // The block owns the slots
+		l->weight[i] = cfg->weights ? cfg->weights[i] : 0;
+	}
+	atomic_init(&l->occupied, 0);
+	cbl_refill(l);
+	return (0);
+}
+
+static inline void	cbl_free(CircularLaneBuffer *l)
+{
+	if (!l || !l->block)
+		return;
+	if (l->alloc.free)
+		l->alloc.free(l->alloc.ctx, l->block);
+	l->block = NULL;
+	l->lanes = NULL;
+}
+
+static inline CircularBuffer	*cbl_lane(CircularLaneBuffer *l, uint32_t lane)
+{
+	assert(lane < l->count && "lane out of range");
+	return (&l->lanes[lane]);
+}
+
+/* -- Producer side --
+   Claim on cbl_lane(l, lane) with the cb_push_claim* calls as usual, but
+   publish through here so the lane's bit gets set. Each call costs one
+   fence, so claim several slots and publish them with one
+   cbl_push_publish_n to pay it once per batch. */
+
+static inline void	cbl_push_publish_n(CircularLaneBuffer *l, uint32_t lane, cb_seq_t pos, uint32_t count)
+{
+	uint64_t bit = (uint64_t)1 << lane;
+
+	cb_push_publish_n(cbl_lane(l, lane), pos, count);
+	// Publish before the load, even when the bit turns out set: pairs with
+	// the consumer's clear-then-rescan (see the header comment)
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!(atomic_load_explicit(&l->occupied, memory_order_relaxed) & bit))
+		atomic_fetch_or_explicit(&l->occupied, bit, memory_order_relaxed);
+}
+
+static inline void	cbl_push_publish(CircularLaneBuffer *l, uint32_t lane, cb_seq_t pos)
+{
+	cbl_push_publish_n(l, lane, pos, 1);
+}
+
+/* Copying shortcut: 0 on success, -1 when that lane is full. */
+static inline int	cbl_push(CircularLaneBuffer *l, uint32_t lane, const void *data, uint32_t size)
+{
+	assert(size <= l->lanes[0].slot_size && "size exceeds slot_size");
+
+	cb_seq_t	pos;
+	void		*slot = cb_push_claim(cbl_lane(l, lane), &pos);
+
+	if (!slot)
+		return (-1); // Full
+	memcpy(slot, data, size);
+	cbl_push_publish(l, lane, pos);
+	return (0);
+}
+
+/* -- Consumer side -- */
+
+/* Claims up to max messages from the first non-empty lane that still has
+   credit this round, never more than its remaining credit. Returns the
+   number claimed (0 when every lane is empty), the lane in *out_lane and
+   the start in *out_pos; read them with cb_slot_data(cbl_lane(l, lane),
+   pos + i) and hand them back with cbl_pop_release. */
+static inline uint32_t	cbl_pop_claim(CircularLaneBuffer *l, uint32_t max, uint32_t *out_lane, cb_seq_t *out_pos)
+{
+	assert(l != NULL && "l is NULL");
+	assert(max > 0 && "max must be > 0");
+	assert(out_lane != NULL && out_pos != NULL && "out_lane and out_pos are required");
+
+	uint64_t occupied = atomic_load_explicit(&l->occupied, memory_order_relaxed);
+
+	while (occupied)
+	{
+		uint64_t candidates = occupied & l->credit_mask;
+
+		if (!candidates)
+		{
+			cbl_refill(l); // Every non-empty lane has had its turn
+			candidates = occupied;
+		}
+
+		uint32_t		lane = cb_ctz64(candidates);
+		uint64_t		bit = (uint64_t)1 << lane;
+		CircularBuffer	*cb = &l->lanes[lane];
+		uint32_t		want = l->weight[lane] && l->credit[lane] < max ? l->credit[lane] : max;
+		uint32_t		n = cb_pop_claim_n(cb, want, out_pos);
+
+		if (n == 0)
+		{
+			atomic_fetch_and_explicit(&l->occupied, ~bit, memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+			n = cb_pop_claim_n(cb, want, out_pos);
+			if (n == 0)
+			{
+				occupied &= ~bit;
+				continue;
+			}
+			atomic_fetch_or_explicit(&l->occupied, bit, memory_order_relaxed);
+		}
+		if (l->weight[lane] && (l->credit[lane] -= n) == 0)
+			l->credit_mask &= ~bit;
+		*out_lane = lane;
+		return (n);
+	}
+	return (0); // Empty
+}
+
+static inline void	cbl_pop_release(CircularLaneBuffer *l, uint32_t lane, cb_seq_t pos, uint32_t count)
+{
+	cb_pop_release_n(cbl_lane(l, lane), pos, count);
+}
+
+/* Copying wrapper: returns the lane the message came from, or -1 when
+   every lane is empty. */
+static inline int	cbl_pop(CircularLaneBuffer *l, void *data, uint32_t size)
+{
+	assert(size <= l->lanes[0].slot_size && "size exceeds slot_size");
+
+	uint32_t	lane;
+	cb_seq_t	pos;
+
+	if (cbl_pop_claim(l, 1, &lane, &pos) == 0)
+		return (-1);
+	memcpy(data, cb_slot_data(&l->lanes[lane], pos), size);
+	cbl_pop_release(l, lane, pos, 1);
+	return ((int)lane);
+}
+
+#endif // CIRCBUF_LANES_H
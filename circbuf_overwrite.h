@@ -0,0 +1,197 @@
+#ifndef CIRCBUF_OVERWRITE_H
+# define CIRCBUF_OVERWRITE_H
+
+#include "circbuf.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* -- Overwrite ring --
+   A lossy ring for telemetry and "latest N" views: the producer never
+   waits and never fails, it simply overwrites the oldest slot. Readers
+   are passive, each with its own cursor in a CbOverwriteReader, and any
+   number of them may follow the ring without registering; the producer
+   never looks at them.
+
+   Each slot is a seqlock. Its stamp word is odd while the producer is
+   writing position pos and ((pos + 1) << 1) once it is done. A reader
+   checks the stamp, copies the payload, then checks the stamp again; if
+   they differ, or the first is not the one for its position, the slot
+   was overwritten under it and the reader skips forward to the oldest
+   position that is still intact, counting what it lost in dropped.
+   Payloads are copied in and out a word at a time with relaxed atomics,
+   so a torn read is detected rather than undefined; there is no
+   zero-copy claim API for the same reason.
+
+   One producer thread. Each CbOverwriteReader belongs to one thread. */
+
+typedef struct {
+	_Atomic uint64_t				*words;		// stride_words per slot: stamp, then payload
+	uint32_t						slot_size;
+	uint32_t						stride_words;
+	uint32_t						mask;
+	Allocator						alloc;
+	_Alignas(64) _Atomic cb_seq_t	head;		// next position to write
+} CircularOverwriteBuffer;
+
+typedef struct {
+	cb_seq_t	pos;		// next position to read
+	uint64_t	dropped;	// positions overwritten before this reader got to them
+} CbOverwriteReader;
+
+static inline uint64_t	cbo_done(cb_seq_t pos) { return (((uint64_t)pos + 1) << 1); }
+static inline uint64_t	cbo_writing(cb_seq_t pos) { return (((uint64_t)pos << 1) | 1); }
+
+static inline _Atomic uint64_t	*cbo_slot(CircularOverwriteBuffer *o, cb_seq_t pos)
+{
+	return (o->words + (size_t)(pos & o->mask) * o->stride_words);
+}
+
+static inline int	cbo_init(CircularOverwriteBuffer *o, Allocator alloc, uint32_t capacity, uint32_t slot_size)
+{
+	assert(o != NULL && "o is NULL");
+	assert(alloc.alloc != NULL && "allocator must provide alloc function");
+	assert(capacity >= 2 && (capacity & (capacity - 1)) == 0 && "capacity must be a power of two");
+	assert(slot_size > 0 && "slot_size must be > 0");
+
+	if (!o || !alloc.alloc || capacity < 2 || (capacity & (capacity - 1)) != 0 || slot_size == 0)
+		return (-EINVAL);
+
+	o->alloc = alloc;
+	o->slot_size = slot_size;
+	o->stride_words = 1 + (slot_size + 7) / 8;
+	o->mask = capacity - 1;
+	o->words = alloc.alloc(alloc.ctx, (size_t)capacity * o->stride_words * sizeof(uint64_t), CIRCBUF_CACHE_LINE);
+	if (!o->words)
+		return (-ENOMEM);
+	for (size_t i = 0; i < (size_t)capacity * o->stride_words; ++i)
+		atomic_init(&o->words[i], 0); // Stamp 0 is never a valid one
+	atomic_init(&o->head, 0);
+	return (0);
+}
+
+static inline void	cbo_free(CircularOverwriteBuffer *o)
+{
+	if (!o || !o->words)
+		return;
+	if (o->alloc.free)
+		o->alloc.free(o->alloc.ctx, o->words);
+	o->words = NULL;
+}
+
+/* Word-wise copies; the last partial word is zero-padded on the way in. */
+static inline void	cbo_copy_in(_Atomic uint64_t *dst, const void *src, uint32_t size)
+{
+	const uint8_t	*in = (const uint8_t *)src;
+	uint64_t		w;
+
+	for (; size >= 8; size -= 8, in += 8, ++dst)
+	{
+		memcpy(&w, in, 8);
+		atomic_store_explicit(dst, w, memory_order_relaxed);
+	}
+	if (size)
+	{
+		w = 0;
+		memcpy(&w, in, size);
+		atomic_store_explicit(dst, w, memory_order_relaxed);
+	}
+}
+
+static inline void	cbo_copy_out(void *dst, _Atomic uint64_t *src, uint32_t size)
+{
+	uint8_t		*out = (uint8_t *)dst;
+	uint64_t	w;
+
+	for (; size >= 8; size -= 8, out += 8, ++src)
+	{
+		w = atomic_load_explicit(src, memory_order_relaxed);
+		memcpy(out, &w, 8);
+	}
+	if (size)
+	{
+		w = atomic_load_explicit(src, memory_order_relaxed);
+		memcpy(out, &w, size);
+	}
+}
+
+/* Always succeeds; readers more than capacity - 1 behind lose the oldest. */
+static inline void	cbo_push(CircularOverwriteBuffer *o, const void *data, uint32_t size)
+{
+	assert(o != NULL && data != NULL && "o and data are required");
+	assert(size <= o->slot_size && "size exceeds slot_size");
+
+	cb_seq_t			pos = atomic_load_explicit(&o->head, memory_order_relaxed);
+	_Atomic uint64_t	*slot = cbo_slot(o, pos);
+
+	atomic_store_explicit(&slot[0], cbo_writing(pos), memory_order_relaxed);
+	atomic_thread_fence(memory_order_release); // Odd stamp before any payload word
+	cbo_copy_in(slot + 1, data, size);
+	atomic_store_explicit(&slot[0], cbo_done(pos), memory_order_release);
+	atomic_store_explicit(&o->head, pos + 1, memory_order_release);
+}
+
+/* Starts r at most backlog messages behind the newest (0 = only messages
+   pushed from now on). */
+static inline void	cbo_reader_init(CircularOverwriteBuffer *o, CbOverwriteReader *r, uint32_t backlog)
+{
+	assert(o != NULL && r != NULL && "o and r are required");
+
+	cb_seq_t head = atomic_load_explicit(&o->head, memory_order_acquire);
+
+	if (backlog > o->mask)
+		backlog = o->mask;
+	if ((cb_seq_t)backlog > head)
+		backlog = (uint32_t)head;
+	r->pos = head - backlog;
+	r->dropped = 0;
+}
+
+/* Copies the next message for r. Returns 0, or -1 when r has caught up.
+   Anything overwritten before r got to it is skipped and added to
+   r->dropped. */
+static inline int	cbo_read(CircularOverwriteBuffer *o, CbOverwriteReader *r, void *data, uint32_t size)
+{
+	assert(o != NULL && r != NULL && data != NULL && "o, r and data are required");
+	assert(size <= o->slot_size && "size exceeds slot_size");
+
+	for (;;)
+	{
+		cb_seq_t	head = atomic_load_explicit(&o->head, memory_order_acquire);
+		cb_seq_t	oldest = head - o->mask; // The producer may already be writing over head - capacity
+
+		if (r->pos == head)
+			return (-1); // Caught up
+		if ((cb_sdiff_t)(r->pos - oldest) < 0)
+		{
+			r->dropped += (uint64_t)(oldest - r->pos);
+			r->pos = oldest;
+		}
+
+		_Atomic uint64_t	*slot = cbo_slot(o, r->pos);
+		uint64_t			stamp = atomic_load_explicit(&slot[0], memory_order_acquire);
+
+		if (stamp != cbo_done(r->pos))
+			continue; // Overwritten since we loaded head
+		cbo_copy_out(data, slot + 1, size);
+		atomic_thread_fence(memory_order_acquire); // Payload words before the second stamp load
+		if (atomic_load_explicit(&slot[0], memory_order_relaxed) != stamp)
+			continue; // Torn: overwritten while we copied
+		r->pos++;
+		return (0);
+	}
+}
+
+/* Last-value read: copies the newest message. Returns 0, or -1 if
+   nothing was ever pushed. */
+static inline int	cbo_latest(CircularOverwriteBuffer *o, void *data, uint32_t size)
+{
+	cb_seq_t			head = atomic_load_explicit(&o->head, memory_order_acquire);
+	CbOverwriteReader	r = { .pos = head - 1 };
+
+	if (head == 0)
+		return (-1);
+	return (cbo_read(o, &r, data, size));
+}
+
+#endif // CIRCBUF_OVERWRITE_H
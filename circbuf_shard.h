@@ -0,0 +1,217 @@
+#ifndef CIRCBUF_SHARD_H
+# define CIRCBUF_SHARD_H
+
+#include "circbuf.h"
+
+#include <errno.h>
+#include <string.h>
+#if defined(__linux__) && defined(_GNU_SOURCE)
+# include <sched.h>
+#endif
+
+/* -- Sharded queue --
+   count independent CircularBuffers, one per producer (or per producer
+   group: a core, a NUMA node). Producers push into their own shard, so
+   head lines are never shared across shards; consumers drain a home shard
+   and, when it is empty, steal from the others in turn, starting next to
+   home so thieves spread out.
+
+   Without CB_SHARD_FIFO the shards are multi-consumer (SPMC/MPMC) and
+   consumers pop from any shard directly; messages from one shard leave it
+   in order but may be processed out of order by different consumers.
+   With CB_SHARD_FIFO each shard has an owner flag and a single-consumer
+   mode (SPSC/MPSC): a claim takes the flag (try-lock, never waits) and
+   the release drops it, so one shard's messages are claimed and released
+   strictly in order, by one consumer at a time.
+
+   cbs_home uses sched_getcpu(3) when the includer defines _GNU_SOURCE;
+   otherwise each thread gets a fixed home, dealt out round-robin. */
+
+# define CB_SHARD_FIFO	1u
+
+typedef struct {
+	uint32_t	count;			// number of shards
+	uint32_t	capacity;		// per shard
+	uint32_t	slot_size;
+	CbLayout	layout;
+	int			multi_producer;	// several producers may share one shard
+	uint32_t	flags;			// CB_SHARD_*
+} CbShardConfig;
+
+typedef struct {
+	_Alignas(64) _Atomic uint32_t	busy;	// CB_SHARD_FIFO: a consumer holds this shard
+} CbShardOwner;
+
+typedef struct {
+	CircularBuffer	*shards;
+	CbShardOwner	*owners;	// CB_SHARD_FIFO only
+	uint32_t		count;
+	uint32_t		flags;
+	Allocator		alloc;
+} CircularShardedBuffer;
+
+static inline void	cbs_free(CircularShardedBuffer *s)
+{
+	if (!s || !s->shards)
+		return;
+	for (uint32_t i = 0; i < s->count; ++i)
+		cb_free(&s->shards[i]);
+	if (s->alloc.free)
+	{
+		s->alloc.free(s->alloc.ctx, s->shards);
+		s->alloc.free(s->alloc.ctx, s->owners);
+	}
+	s->shards = NULL;
+	s->owners = NULL;
+}
+
+static inline int	cbs_init(CircularShardedBuffer *s, Allocator alloc, const CbShardConfig *cfg)
+{
+	assert(s != NULL && "s is NULL");
+	assert(cfg != NULL && "cfg is NULL");
+	assert(alloc.alloc != NULL && "allocator must provide alloc function");
+	assert(cfg->count > 0 && "need at least one shard");
+
+	if (!s || !cfg || !alloc.alloc || cfg->count == 0)
+		return (-EINVAL);
+
+	int fifo = (cfg->flags & CB_SHARD_FIFO) != 0;
+	CircularBufferConfig shard_cfg = {
+		.capacity = cfg->capacity,
+		.slot_size = cfg->slot_size,
+		.layout = cfg->layout,
+		.mode = (CbMode)((cfg->multi_producer ? CB_MPSC : 0) | (fifo ? 0 : CB_SPMC)),
+	};
+
+	s->count = cfg->count;
+	s->flags = cfg->flags;
+	s->alloc = alloc;
+	s->owners = NULL;
+	s->shards = alloc.alloc(alloc.ctx, cfg->count * sizeof(CircularBuffer), CIRCBUF_CACHE_LINE);
+	if (!s->shards)
+		return (-ENOMEM);
+	memset(s->shards, 0, cfg->count * sizeof(CircularBuffer));
+	if (fifo)
+	{
+		s->owners = alloc.alloc(alloc.ctx, cfg->count * sizeof(CbShardOwner), CIRCBUF_CACHE_LINE);
+		if (!s->owners)
+		{
+			cbs_free(s);
+			return (-ENOMEM);
+		}
+		for (uint32_t i = 0; i < cfg->count; ++i)
+			atomic_init(&s->owners[i].busy, 0);
+	}
+	for (uint32_t i = 0; i < cfg->count; ++i)
+	{
+		int err = cb_init_ex(&s->shards[i], alloc, &shard_cfg);
+		if (err != 0)
+		{
+			cbs_free(s);
+			return (err);
+		}
+	}
+	return (0);
+}
+
+/* The shard for the calling thread's current CPU (or, without
+   _GNU_SOURCE, a per-thread one): a reasonable home for producers and
+   consumers that are not pinned to a fixed shard. */
+static inline uint32_t	cbs_home(CircularShardedBuffer *s)
+{
+	static _Thread_local uint32_t	thread_id = UINT32_MAX;
+	static _Atomic uint32_t			next_thread_id;
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+	int cpu = sched_getcpu();
+
+	if (cpu >= 0)
+		return ((uint32_t)cpu % s->count);
+#endif
+	if (thread_id == UINT32_MAX)
+		thread_id = atomic_fetch_add_explicit(&next_thread_id, 1, memory_order_relaxed);
+	return (thread_id % s->count);
+}
+
+static inline CircularBuffer	*cbs_shard(CircularShardedBuffer *s, uint32_t shard)
+{
+	assert(shard < s->count && "shard out of range");
+	return (&s->shards[shard]);
+}
+
+/* Producer side: the full cb_push_* API works on cbs_shard(s, shard);
+   this is the copying shortcut. 0 on success, -1 when that shard is full. */
+static inline int	cbs_push(CircularShardedBuffer *s, uint32_t shard, const void *data, uint32_t size)
+{
+	return (cb_push(cbs_shard(s, shard), data, size));
+}
+
+/* Claims up to max messages, from home if it has any, else from the
+   first other shard that does. Returns the number claimed (0 if every
+   shard looked empty), the shard in *out_shard and the start in
+   *out_pos; read them with cb_slot_data(cbs_shard(s, shard), pos + i)
+   and hand them back with cbs_pop_release. */
+static inline uint32_t	cbs_pop_claim(CircularShardedBuffer *s, uint32_t home, uint32_t max,
+	uint32_t *out_shard, cb_seq_t *out_pos)
+{
+	assert(s != NULL && "s is NULL");
+	assert(home < s->count && "home out of range");
+	assert(out_shard != NULL && out_pos != NULL && "out_shard and out_pos are required");
+
+	for (uint32_t i = 0; i < s->count; ++i)
+	{
+		uint32_t		shard = home + i < s->count ? home + i : home + i - s->count;
+		CircularBuffer	*cb = &s->shards[shard];
+		uint32_t		n;
+
+		if (!(s->flags & CB_SHARD_FIFO))
+			n = cb_pop_claim_n(cb, max, out_pos);
+		else
+		{
+			uint32_t idle = 0;
+
+			// Skip shards that look empty or taken without writing their flag
+			if (cb_size_approx(cb) == 0
+					|| atomic_load_explicit(&s->owners[shard].busy, memory_order_relaxed)
+					|| !atomic_compare_exchange_strong_explicit(&s->owners[shard].busy, &idle, 1,
+						memory_order_acquire, memory_order_relaxed))
+				continue;
+			n = cb_pop_claim_n(cb, max, out_pos);
+			if (n == 0)
+				atomic_store_explicit(&s->owners[shard].busy, 0, memory_order_release);
+		}
+		if (n)
+		{
+			*out_shard = shard;
+			return (n);
+		}
+	}
+	return (0); // Empty
+}
+
+static inline void	cbs_pop_release(CircularShardedBuffer *s, uint32_t shard, cb_seq_t pos, uint32_t count)
+{
+	assert(s != NULL && shard < s->count && "invalid shard");
+
+	cb_pop_release_n(&s->shards[shard], pos, count);
+	if (s->flags & CB_SHARD_FIFO)
+		atomic_store_explicit(&s->owners[shard].busy, 0, memory_order_release);
+}
+
+/* Copying wrapper: returns the shard the message came from, or -1 when
+   every shard looked empty. */
+static inline int	cbs_pop(CircularShardedBuffer *s, uint32_t home, void *data, uint32_t size)
+{
+	assert(size <= s->shards[0].slot_size && "size exceeds slot_size");
+
+	uint32_t	shard;
+	cb_seq_t	pos;
+
+	if (cbs_pop_claim(s, home, 1, &shard, &pos) == 0)
+		return (-1);
+	memcpy(data, cb_slot_data(&s->shards[shard], pos), size);
+	cbs_pop_release(s, shard, pos, 1);
+	return ((int)shard);
+}
+
+#endif // CIRCBUF_SHARD_H
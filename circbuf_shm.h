@@ -0,0 +1,197 @@
+#ifndef CIRCBUF_SHM_H
+# define CIRCBUF_SHM_H
+
+#include "circbuf.h"
+
+#ifdef __linux__
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+
+/* -- Shared-memory ring --
+   One named POSIX shm segment holds everything:
+     [CbShmHeader][CircularBuffer][slots]
+   The buffer reaches its slots through a self-relative offset, so every
+   process may map the segment at a different address. The creator
+   initialises the buffer in place with CB_FLAG_SHARED (process-shared
+   futexes for the blocking calls) and stores the magic last; attach
+   refuses segments whose magic, version, cb_seq_t width or struct size do
+   not match its own build, so both sides must agree on CIRCBUF_SEQ64 and
+   CIRCBUF_STATS. Mirrored rings and watermark callbacks are not supported:
+   neither a second mapping nor a function pointer survives the process
+   boundary. The mode still describes the whole system, e.g. CB_SPSC for
+   one producer process and one consumer process.
+
+   Names follow shm_open(3): a leading '/', no other slashes. The layout
+   code works on any shared file descriptor; circbuf_journal.h uses it
+   for rings in regular files.
+
+   Needs POSIX.1-2001 (shm_open, ftruncate), which strict -std=c11 hides
+   and the header leaves to the includer: define _DEFAULT_SOURCE (or
+   _POSIX_C_SOURCE 200112L) above the first #include, or build with it. */
+
+# if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200112L
+#  error "circbuf_shm.h needs POSIX.1-2001 (_POSIX_C_SOURCE >= 200112L or _DEFAULT_SOURCE) before any system header"
+# endif
+
+# define CB_SHM_MAGIC	0x43425348u	// "CBSH"
+# define CB_SHM_VERSION	3u
+
+typedef struct {
+	_Alignas(CIRCBUF_CACHE_LINE) _Atomic uint32_t	magic;	// Written last by the creator
+	uint32_t		version;
+	uint32_t		seq_bits;	// 8 * sizeof(cb_seq_t)
+	uint32_t		cb_size;	// sizeof(CircularBuffer)
+	uint64_t		size;		// Whole segment, in bytes
+	_Atomic cb_seq_t	commit;	// circbuf_journal.h: consumer's committed position
+} CbShmHeader;
+
+typedef struct {
+	CbShmHeader		*seg;
+	size_t			size;
+	CircularBuffer	*cb;	// Inside seg, valid until cb_shm_detach
+} CbShm;
+
+/* Byte offsets of the buffer and of its slots from the segment start. */
+static inline size_t	cb_shm_cb_offset(void)
+{
+	return (cb_align_up(sizeof(CbShmHeader), _Alignof(CircularBuffer)));
+}
+
+static inline size_t	cb_shm_slots_offset(void)
+{
+	return (cb_align_up(cb_shm_cb_offset() + sizeof(CircularBuffer), CIRCBUF_CACHE_LINE));
+}
+
+/* Sizes the (empty) file fd for cfg, maps it with map_flags and
+   initialises the buffer in it. Returns 0 or -errno, with nothing mapped
+   on failure. */
+static inline int	cb_shm_init_fd(CbShm *shm, int fd, const CircularBufferConfig *cfg, int map_flags)
+{
+	CircularBufferConfig	shared = *cfg;
+	size_t					page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t					size;
+	uint8_t					*base;
+
+	shared.flags |= CB_FLAG_SHARED;
+	size = cb_align_up(cb_shm_slots_offset() + cb_slots_size(&shared), page);
+	if (ftruncate(fd, (off_t)size) != 0)
+		return (-errno);
+	if ((base = mmap(NULL, size, PROT_READ | PROT_WRITE, map_flags, fd, 0)) == MAP_FAILED)
+		return (-errno);
+
+	CircularBuffer	*cb = (CircularBuffer *)(base + cb_shm_cb_offset());
+	Allocator		place = cb_place(base + cb_shm_slots_offset());
+	int				err = cb_init_ex(cb, place, &shared);
+
+	if (err != 0)
+	{
+		munmap(base, size);
+		return (err);
+	}
+	memset(&cb->alloc, 0, sizeof(cb->alloc)); // Nothing to free; the segment owns the slots
+	shm->seg = (CbShmHeader *)base;
+	shm->size = size;
+	shm->cb = cb;
+	shm->seg->version = CB_SHM_VERSION;
+	shm->seg->seq_bits = 8 * (uint32_t)sizeof(cb_seq_t);
+	shm->seg->cb_size = (uint32_t)sizeof(CircularBuffer);
+	shm->seg->size = size;
+	atomic_init(&shm->seg->commit, 0);
+	atomic_store_explicit(&shm->seg->magic, CB_SHM_MAGIC, memory_order_release);
+	return (0);
+}
+
+/* Maps a ring set up by cb_shm_init_fd. -EAGAIN: the creator has not
+   finished (or fd is not a ring); -EPROTO: built with a different layout. */
+static inline int	cb_shm_map_fd(CbShm *shm, int fd, int map_flags)
+{
+	struct stat	st;
+	uint8_t		*base;
+
+	if (fstat(fd, &st) != 0)
+		return (-errno);
+	if ((size_t)st.st_size < cb_shm_slots_offset())
+		return (-EAGAIN); // Not truncated yet
+	if ((base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, map_flags, fd, 0)) == MAP_FAILED)
+		return (-errno);
+
+	CbShmHeader	*seg = (CbShmHeader *)base;
+	int			err = 0;
+
+	if (atomic_load_explicit(&seg->magic, memory_order_acquire) != CB_SHM_MAGIC)
+		err = -EAGAIN;
+	else if (seg->version != CB_SHM_VERSION || seg->seq_bits != 8 * sizeof(cb_seq_t)
+			|| seg->cb_size != sizeof(CircularBuffer) || seg->size != (uint64_t)st.st_size)
+		err = -EPROTO;
+	if (err != 0)
+	{
+		munmap(base, (size_t)st.st_size);
+		return (err);
+	}
+	shm->seg = seg;
+	shm->size = (size_t)st.st_size;
+	shm->cb = (CircularBuffer *)(base + cb_shm_cb_offset());
+	return (0);
+}
+
+/* Creates the segment name (which must not exist yet) sized for cfg and
+   initialises the buffer in it. Returns 0 or -errno; on failure nothing
+   is left behind. */
+static inline int	cb_shm_create(CbShm *shm, const char *name, const CircularBufferConfig *cfg)
+{
+	assert(shm != NULL && name != NULL && cfg != NULL && "shm, name and cfg are required");
+	assert(!(cfg->flags & CB_FLAG_MIRRORED) && "shared rings cannot be mirrored");
+	if (!shm || !name || !cfg || (cfg->flags & CB_FLAG_MIRRORED) || cfg->on_watermark)
+		return (-EINVAL);
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return (-errno);
+
+	int err = cb_shm_init_fd(shm, fd, cfg, MAP_SHARED);
+
+	close(fd);
+	if (err != 0)
+		shm_unlink(name);
+	return (err);
+}
+
+/* Maps an existing segment; errors as for cb_shm_map_fd. */
+static inline int	cb_shm_attach(CbShm *shm, const char *name)
+{
+	assert(shm != NULL && name != NULL && "shm and name are required");
+	if (!shm || !name)
+		return (-EINVAL);
+
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return (-errno);
+
+	int err = cb_shm_map_fd(shm, fd, MAP_SHARED);
+
+	close(fd);
+	return (err);
+}
+
+/* Unmaps this process's view; the ring itself lives on until unlinked
+   and unmapped everywhere. */
+static inline void	cb_shm_detach(CbShm *shm)
+{
+	if (!shm || !shm->seg)
+		return;
+	munmap(shm->seg, shm->size);
+	shm->seg = NULL;
+	shm->cb = NULL;
+	shm->size = 0;
+}
+
+static inline int	cb_shm_unlink(const char *name)
+{
+	return (shm_unlink(name) != 0 ? -errno : 0);
+}
+
+#endif // __linux__
+#endif // CIRCBUF_SHM_H
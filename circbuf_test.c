@@ -1,27 +1,140 @@
+#define _GNU_SOURCE // recvmmsg / sendmmsg for circbuf_io.h
 #include <stdatomic.h>
 #define CIRCBUF_IMPLEMENTATION
 #define MEMARENA_IMPLEMENTATION
-// #define CIRCBUF_MPMC  // Uncomment this to test MPMC, or pass via compiler flags
 #include "circbuf.h"
+#include "circbuf_batch.h"
+#include "circbuf_bcast.h"
+#include "circbuf_grow.h"
+#include "circbuf_io.h"
+#include "circbuf_journal.h"
+#include "circbuf_lanes.h"
+#include "circbuf_overwrite.h"
+#include "circbuf_shard.h"
+#include "circbuf_shm.h"
+#include "circbuf_typed.h"
+#include "circbuf_uring.h"
 #include "arena_allocator.h"
+#include "mirror_allocator.h"
+#include "mmap_allocator.h"
 
 #include <stdio.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #define CAPACITY    1024
-#define MSG_COUNT   10000000 // Ensure this is divisible by thread counts
+#ifndef MSG_COUNT
+# define MSG_COUNT  10000000 // per row; -DMSG_COUNT=200000 for a quick pre-merge run
+#endif
 
-#ifdef CIRCBUF_MPMC
-# define NUM_PRODUCERS 4
-# define NUM_CONSUMERS 4
-#else
-# define NUM_PRODUCERS 1
-# define NUM_CONSUMERS 1
+#ifndef BATCH_SIZE
+# define BATCH_SIZE 1 // > 1 exercises cb_push_claim_n / cb_pop_claim_n
 #endif
 
+#define MAX_THREADS 4
+
+_Static_assert(MSG_COUNT % MAX_THREADS == 0, "MSG_COUNT must split evenly across the thread counts");
+
+#define PRODUCER_CHUNK  16
+#define PRODUCER_FLUSH  7	// batched producers flush every PRODUCER_FLUSH messages, leaving fillers
+
+#define PUBLISH_INTERVAL 32
+
+#define PREFETCH_DISTANCE 8
+#define PEEK_MAX          64
+
+#define INDEX_MAX_CAPACITY 4096
+
+#define IO_DATAGRAMS    40	// a few laps of the ring
+#define IO_SLOTS        16
+#define IO_SEND_BATCH   8	// below the default unix datagram queue length (10)
+#define IO_DGRAM_MAX    60	// largest datagram payload a slot holds
+#define IO_STREAM_BYTES 20000
+
+#define URING_RECORDS   50
+#define URING_BATCH     8	// io_uring entries, fewer than IO_SLOTS: the window limits too
+#define URING_WARMUP    (3 * IO_SLOTS + 5)	// ring traffic before the adapter attaches, mid-lap
+#define URING_PIPE_CHUNK 97	// pipe writes split and straddle the linked reads
+
+#define WM_CAPACITY     64
+#define WM_HIGH         44	// not a multiple of WM_INTERVAL: crossings are only seen at the next check
+#define WM_LOW          20
+#define WM_INTERVAL     8
+
+#define MMAP_CAPACITY   4096	// slots of a Message: a few pages, well under a huge page
+
+#define BULK_RECORD     20
+#define BULK_COUNT      37	// odd, so bulk ranges wrap at varying offsets
+
+#define BCAST_READERS   3
+
+#define LANE_CAPACITY   256
+#define LANE_HANDOFF    (MSG_COUNT / 50)	// one at a time, so the lane keeps running dry
+
+#define LOSSY_CAPACITY  64
+#define LOSSY_STALL     1024	// the slow reader naps every LOSSY_STALL messages
+
+#define SHM_CAPACITY     64
+#define SHM_MESSAGES     10000	// many laps, so both processes wait on each other
+#define SHM_TIMEOUT_NS   (10 * 1000000000LL)
+
+#define JOURNAL_CAPACITY 64
+#define JOURNAL_COMMIT   10	// messages consumed and committed before the "crash"
+
+#define GROW_CAPACITY   64
+#define GROW_MAX        65536
+#define GROW_BURST      4096	// consumer stalls every GROW_BURST messages
+
+#define BYTE_CAPACITY   65536
+#define BYTE_MIN_RECORD 24
+#define BYTE_MAX_RECORD 1500
+
+static const struct {
+	CbMode		mode;
+	const char	*name;
+	int			producers;
+	int			consumers;
+	int			wait;		// use cb_push_wait / cb_pop_wait
+	int			batched;	// producers go through a CbPushBatch
+	uint32_t	flags;		// CB_FLAG_*
+	uint32_t	publish;	// publish_interval
+	uint32_t	prefetch;	// prefetch_distance; consumers go through cb_pop_peek_n
+	CbBackoff	backoff;	// CAS retry policy
+} modes[] = {
+	{ CB_SPSC, "SPSC", 1, 1, 0, 0, 0, 0, 0, CB_BACKOFF_NONE },
+	// The per-slot seq protocol SPSC used before the cached cursors, as a baseline
+	{ CB_SPSC, "SPSC via slot seq (baseline)", 1, 1, 0, 0, CB_FLAG_SLOT_SEQ, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPSC, "MPSC", MAX_THREADS, 1, 0, 0, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_SPMC, "SPMC", 1, MAX_THREADS, 0, 0, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPMC, "MPMC", MAX_THREADS, MAX_THREADS, 0, 0, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_SPSC, "SPSC (blocking)", 1, 1, 1, 0, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPMC, "MPMC (blocking)", MAX_THREADS, MAX_THREADS, 1, 0, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPSC, "MPSC (producer batching)", MAX_THREADS, 1, 0, 1, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPMC, "MPMC (producer batching)", MAX_THREADS, MAX_THREADS, 0, 1, 0, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPMC, "MPMC (fetch-and-add)", MAX_THREADS, MAX_THREADS, 0, 0, CB_FLAG_FAA, 0, 0, CB_BACKOFF_NONE },
+	{ CB_MPMC, "MPMC (fetch-and-add, blocking)", MAX_THREADS, MAX_THREADS, 1, 0, CB_FLAG_FAA, 0, 0, CB_BACKOFF_NONE },
+	{ CB_SPSC, "SPSC (lazy publish)", 1, 1, 0, 0, 0, PUBLISH_INTERVAL, 0, CB_BACKOFF_NONE },
+	{ CB_SPSC, "SPSC (lazy publish, blocking)", 1, 1, 1, 0, 0, PUBLISH_INTERVAL, 0, CB_BACKOFF_NONE },
+	{ CB_SPSC, "SPSC (prefetch, peek)", 1, 1, 0, 0, 0, 0, PREFETCH_DISTANCE, CB_BACKOFF_NONE },
+	{ CB_MPSC, "MPSC (prefetch, peek)", MAX_THREADS, 1, 0, 0, 0, 0, PREFETCH_DISTANCE, CB_BACKOFF_NONE },
+	// Contended CAS retries under each backoff policy, at two thread counts
+	{ CB_MPMC, "MPMC 2x2 (pause backoff)", 2, 2, 0, 0, 0, 0, 0, CB_BACKOFF_PAUSE },
+	{ CB_MPMC, "MPMC 2x2 (exponential backoff)", 2, 2, 0, 0, 0, 0, 0, CB_BACKOFF_EXP },
+	{ CB_MPMC, "MPMC (exponential backoff)", MAX_THREADS, MAX_THREADS, 0, 0, 0, 0, 0, CB_BACKOFF_EXP },
+	{ CB_MPMC, "MPMC 2x2 (yield backoff)", 2, 2, 0, 0, 0, 0, 0, CB_BACKOFF_YIELD },
+	{ CB_MPMC, "MPMC (yield backoff)", MAX_THREADS, MAX_THREADS, 0, 0, 0, 0, 0, CB_BACKOFF_YIELD },
+	{ CB_MPMC, "MPMC (fetch-and-add, exponential backoff)", MAX_THREADS, MAX_THREADS, 0, 0, CB_FLAG_FAA, 0, 0, CB_BACKOFF_EXP },
+};
+
+// Rows whose throughput main compares
+#define MODE_SPSC      0
+#define MODE_SPSC_SEQ  1
+
 typedef struct {
 	uint32_t	seq;
 	uint64_t	value;
@@ -31,11 +144,15 @@ typedef struct {
 	CircularBuffer	*cb;
 	uint32_t		start_seq;
 	uint32_t		count;
+	int				wait;
+	int				batched;
 } ProdArgs;
 
 typedef struct {
 	CircularBuffer	*cb;
 	uint32_t		count;
+	int				wait;
+	int				peek;	// drain with cb_pop_peek_n
 	_Atomic uint8_t	*received_tracker;
 } ConsArgs;
 
@@ -44,6 +161,49 @@ static void *producer(void *arg)
 	ProdArgs		*args = (ProdArgs *)arg;
 	CircularBuffer	*cb = args->cb;
 
+	if (args->wait)
+	{
+		for (uint32_t i = 0; i < args->count; ++i)
+		{
+			uint32_t seq = args->start_seq + i;
+			Message msg = { .seq = seq, .value = (uint64_t)seq * 31337 };
+			cb_push_wait(cb, &msg, sizeof(msg), -1);
+		}
+		return (NULL);
+	}
+	if (args->batched)
+	{
+		CbPushBatch batch;
+
+		cb_batch_init(&batch, cb, PRODUCER_CHUNK, 0);
+		for (uint32_t i = 0; i < args->count; ++i)
+		{
+			uint32_t seq = args->start_seq + i;
+			Message msg = { .seq = seq, .value = (uint64_t)seq * 31337 };
+			while (cb_batch_push(&batch, &msg, sizeof(msg)) != 0)
+				; /* spin until slot available */
+			if (i % PRODUCER_FLUSH == PRODUCER_FLUSH - 1)
+				cb_batch_poll(&batch);
+		}
+		cb_batch_flush(&batch);
+		return (NULL);
+	}
+#if BATCH_SIZE > 1
+	for (uint32_t i = 0; i < args->count; )
+	{
+		cb_seq_t pos;
+		uint32_t want = args->count - i < BATCH_SIZE ? args->count - i : BATCH_SIZE;
+		uint32_t n = cb_push_claim_n(cb, want, &pos);
+
+		for (uint32_t j = 0; j < n; ++j)
+		{
+			uint32_t seq = args->start_seq + i + j;
+			*(Message *)cb_slot_data(cb, pos + j) = (Message){ .seq = seq, .value = (uint64_t)seq * 31337 };
+		}
+		cb_push_publish_n(cb, pos, n);
+		i += n;
+	}
+#else
 	for (uint32_t i = 0; i < args->count; ++i)
 	{
 		uint32_t seq = args->start_seq + i;
@@ -51,90 +211,141 @@ static void *producer(void *arg)
 		while (cb_push(cb, &msg, sizeof(msg)) != 0)
 			; /* spin until slot available */
 	}
+#endif
+	cb_push_flush(cb);
 	return (NULL);
 }
 
+static uint32_t check_message(ConsArgs *args, const Message *m)
+{
+	Message		msg = *m;
+	uint32_t	errors = 0;
+
+	if (msg.value != (uint64_t)msg.seq * 31337)
+	{
+		fprintf(stderr, "ERROR: expected seq %u (got %" PRIu64 ")\n", msg.seq, msg.value);
+		errors++;
+	}
+	else
+	{
+		uint8_t old_val = atomic_fetch_add_explicit(&args->received_tracker[msg.seq], 1, memory_order_relaxed);
+		if (old_val != 0)
+		{
+			fprintf(stderr, "ERROR: duplicate message received: seq %u\n", msg.seq);
+			errors++;
+		}
+	}
+	return (errors);
+}
+
 static void *consumer(void *arg)
 {
 	ConsArgs		*args = (ConsArgs *)arg;
 	CircularBuffer	*cb = args->cb;
-	Message			msg;
 	uint32_t		errors = 0;
 
-	for (uint32_t i = 0; i < args->count; ++i)
+	if (args->wait)
 	{
-		while (cb_pop(cb, &msg, sizeof(msg)) != 0)
-			; /* spin until data available */
+		Message	msg;
 
-		if (msg.value != (uint64_t)msg.seq * 31337)
+		for (uint32_t i = 0; i < args->count; ++i)
 		{
-			fprintf(stderr, "ERROR: expected seq %u (got %" PRIu64 ")\n", msg.seq, msg.value);
-			errors++;
+			cb_pop_wait(cb, &msg, sizeof(msg), -1);
+			errors += check_message(args, &msg);
 		}
-		else
+		return ((void *)(uintptr_t)errors);
+	}
+	if (args->peek)
+	{
+		void	*slots[PEEK_MAX];
+
+		for (uint32_t i = 0; i < args->count; )
 		{
-			uint8_t old_val = atomic_fetch_add_explicit(&args->received_tracker[msg.seq], 1, memory_order_relaxed);
-			if (old_val != 0)
-			{
-				fprintf(stderr, "ERROR: duplicate message received: seq %u\n", msg.seq);
-				errors++;
-			}
+			cb_seq_t pos;
+			uint32_t want = args->count - i < PEEK_MAX ? args->count - i : PEEK_MAX;
+			uint32_t n = cb_pop_peek_n(cb, slots, want, &pos);
+
+			for (uint32_t j = 0; j < n; ++j)
+				errors += check_message(args, slots[j]);
+			cb_pop_release_n(cb, pos, n);
+			i += n;
 		}
+		return ((void *)(uintptr_t)errors);
 	}
-	return ((void *)(uintptr_t)errors);
-}
-
-int main(void)
-{
-	CircularBuffer	cb;
-	pthread_t		prod_threads[NUM_PRODUCERS];
-	pthread_t		cons_threads[NUM_CONSUMERS];
-	ProdArgs		prod_args[NUM_PRODUCERS];
-	ConsArgs		cons_args[NUM_CONSUMERS];
+#if BATCH_SIZE > 1
+	for (uint32_t i = 0; i < args->count; )
+	{
+		cb_seq_t pos;
+		uint32_t want = args->count - i < BATCH_SIZE ? args->count - i : BATCH_SIZE;
+		uint32_t n = cb_pop_claim_n(cb, want, &pos);
 
-	Arena			arena = arena_init(PROT_READ | PROT_WRITE);
+		for (uint32_t j = 0; j < n; ++j)
+			errors += check_message(args, cb_slot_data(cb, pos + j));
+		cb_pop_release_n(cb, pos, n);
+		i += n;
+	}
+#else
+	Message	msg;
 
-	if (cb_init(&cb, arena_allocator(&arena), CAPACITY, sizeof(Message)) != 0)
+	for (uint32_t i = 0; i < args->count; ++i)
 	{
-		fprintf(stderr, "cb_init failed\n");
-		arena_free(&arena);
-		return (1);
+		while (cb_pop(cb, &msg, sizeof(msg)) != 0)
+			; /* spin until data available */
+		errors += check_message(args, &msg);
 	}
+#endif
+	return ((void *)(uintptr_t)errors);
+}
 
-	_Atomic uint8_t *received_tracker = arena_alloc(&arena, MSG_COUNT * sizeof(_Atomic uint8_t));
-	if (!received_tracker)
+static uint32_t run_mode(Arena *arena, size_t m, _Atomic uint8_t *received_tracker, double *out_throughput)
+{
+	CircularBuffer			cb;
+	CircularBufferConfig	cfg = { .capacity = CAPACITY, .slot_size = sizeof(Message), .mode = modes[m].mode,
+		.flags = modes[m].flags, .publish_interval = modes[m].publish, .prefetch_distance = modes[m].prefetch,
+		.backoff = modes[m].backoff };
+	pthread_t				prod_threads[MAX_THREADS];
+	pthread_t				cons_threads[MAX_THREADS];
+	ProdArgs				prod_args[MAX_THREADS];
+	ConsArgs				cons_args[MAX_THREADS];
+	int						num_producers = modes[m].producers;
+	int						num_consumers = modes[m].consumers;
+
+	if (cb_init_ex(&cb, arena_allocator(arena), &cfg) != 0)
 	{
-		fprintf(stderr, "failed to allocate tracker\n");
-		arena_free(&arena);
+		fprintf(stderr, "cb_init_ex failed\n");
 		return (1);
 	}
+	memset((void *)received_tracker, 0, MSG_COUNT * sizeof(_Atomic uint8_t));
 
-	printf("Mode:          %s\n", NUM_PRODUCERS > 1 ? "MPMC" : "SPSC");
-	printf("Threads:       %d Producers, %d Consumers\n", NUM_PRODUCERS, NUM_CONSUMERS);
+	printf("Mode:          %s\n", modes[m].name);
+	printf("Threads:       %d Producers, %d Consumers\n", num_producers, num_consumers);
 	printf("Messages:      %d total, capacity %d\n", MSG_COUNT, CAPACITY);
+	printf("Batch:         %d\n", BATCH_SIZE);
 
 	struct timespec t0, t1;
 	clock_gettime(CLOCK_MONOTONIC, &t0);
 
-	uint32_t	msg_per_cons = MSG_COUNT / NUM_CONSUMERS;
-	for (int i = 0; i < NUM_CONSUMERS; ++i)
+	uint32_t	msg_per_cons = MSG_COUNT / num_consumers;
+	for (int i = 0; i < num_consumers; ++i)
 	{
-		cons_args[i] = (ConsArgs){ .cb = &cb, .count = msg_per_cons, .received_tracker = received_tracker };
+		cons_args[i] = (ConsArgs){ .cb = &cb, .count = msg_per_cons, .wait = modes[m].wait,
+			.peek = modes[m].prefetch != 0, .received_tracker = received_tracker };
 		pthread_create(&cons_threads[i], NULL, consumer, &cons_args[i]);
 	}
 
-	uint32_t	msg_per_prod = MSG_COUNT / NUM_PRODUCERS;
-	for (int i = 0; i < NUM_PRODUCERS; ++i)
+	uint32_t	msg_per_prod = MSG_COUNT / num_producers;
+	for (int i = 0; i < num_producers; ++i)
 	{
-		prod_args[i] = (ProdArgs){ .cb = &cb, .start_seq = i * msg_per_prod, .count = msg_per_prod };
+		prod_args[i] = (ProdArgs){ .cb = &cb, .start_seq = i * msg_per_prod, .count = msg_per_prod,
+			.wait = modes[m].wait, .batched = modes[m].batched };
 		pthread_create(&prod_threads[i], NULL, producer, &prod_args[i]);
 	}
 
-	for (int i = 0; i < NUM_PRODUCERS; ++i)
+	for (int i = 0; i < num_producers; ++i)
 		pthread_join(prod_threads[i], NULL);
 	
 	uint32_t total_errors = 0;
-	for (int i = 0; i < NUM_CONSUMERS; ++i)
+	for (int i = 0; i < num_consumers; ++i)
 	{
 		void *ret;
 		pthread_join(cons_threads[i], &ret);
@@ -160,13 +371,1800 @@ int main(void)
 
 	printf("Time:		%.3f s\n", elapsed);
 	printf("Throughput:	%.2f M msg/s\n", throughput);
+	*out_throughput = throughput;
+
+#ifdef CIRCBUF_STATS
+	CbStats stats;
+	cb_stats_snapshot(&cb, &stats);
+	printf("Stats:         %llu full, %llu empty, %llu CAS failures, %llu stale, high water %llu\n",
+		(unsigned long long)stats.push_full, (unsigned long long)stats.pop_empty,
+		(unsigned long long)stats.cas_failures, (unsigned long long)stats.stale_retries,
+		(unsigned long long)stats.high_water);
+	// Fillers left by batched producers count as claimed slots
+	if ((modes[m].batched ? stats.push_ok < MSG_COUNT : stats.push_ok != MSG_COUNT)
+			|| stats.pop_ok != MSG_COUNT || stats.high_water > CAPACITY)
+	{
+		fprintf(stderr, "ERROR: stats report %llu pushed, %llu popped\n",
+			(unsigned long long)stats.push_ok, (unsigned long long)stats.pop_ok);
+		total_errors++;
+	}
+#endif
 
 	if (total_errors == 0)
-		printf("OK: all messages received correctly\n");
+		printf("OK: all messages received correctly\n\n");
 	else
-		printf("FAILED: %u errors\n", total_errors);
+		printf("FAILED: %u errors\n\n", total_errors);
 
 	cb_free(&cb);
+	return (total_errors);
+}
+
+/* -- Variable-length ring: sizes cycle through 24..1500 bytes, payload
+   bytes derive from the record index so torn or misplaced records show. -- */
+
+static uint32_t byte_record_size(uint32_t i) { return (BYTE_MIN_RECORD + (i * 613) % (BYTE_MAX_RECORD - BYTE_MIN_RECORD + 1)); }
+
+static void *byte_producer(void *arg)
+{
+	CircularByteBuffer	*cbb = (CircularByteBuffer *)arg;
+	uint8_t				buf[BYTE_MAX_RECORD];
+
+	for (uint32_t i = 0; i < MSG_COUNT; ++i)
+	{
+		uint32_t size = byte_record_size(i);
+		for (uint32_t j = 0; j < size; ++j)
+			buf[j] = (uint8_t)(i + j);
+		while (cbb_push(cbb, buf, size) != 0)
+			; /* spin until room available */
+	}
+	return (NULL);
+}
+
+static void *byte_consumer(void *arg)
+{
+	CircularByteBuffer	*cbb = (CircularByteBuffer *)arg;
+	uint8_t				buf[BYTE_MAX_RECORD];
+	uint32_t			errors = 0;
+
+	for (uint32_t i = 0; i < MSG_COUNT; ++i)
+	{
+		uint32_t size;
+		while (cbb_pop(cbb, buf, sizeof(buf), &size) != 0)
+			; /* spin until data available */
+
+		int ok = (size == byte_record_size(i));
+		for (uint32_t j = 0; ok && j < size; ++j)
+			ok = (buf[j] == (uint8_t)(i + j));
+		if (!ok)
+		{
+			if (errors < 10)
+				fprintf(stderr, "ERROR: byte record %u corrupt (size %u)\n", i, size);
+			errors++;
+		}
+	}
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_bytes(Allocator alloc, uint32_t flags)
+{
+	CircularByteBuffer	cbb;
+	pthread_t			prod_thread;
+	pthread_t			cons_thread;
+	void				*ret;
+	uint8_t				byte = 0;
+
+	if (cbb_init_ex(&cbb, alloc, BYTE_CAPACITY, flags) != 0)
+	{
+		fprintf(stderr, "cbb_init_ex failed\n");
+		return (1);
+	}
+	// Sizes whose aligned total would wrap are refused before any copy
+	if (cbb_push(&cbb, &byte, UINT32_MAX) != -EINVAL || cbb_push(&cbb, &byte, BYTE_CAPACITY - 7) != -EINVAL)
+	{
+		fprintf(stderr, "ERROR: cbb_push accepted a record larger than the ring\n");
+		cbb_free(&cbb);
+		return (1);
+	}
+
+	printf("Mode:          SPSC variable-length%s\n", flags & CB_FLAG_MIRRORED ? ", mirrored" : "");
+	printf("Records:       %d total, %d-%d bytes, capacity %d bytes\n",
+		MSG_COUNT, BYTE_MIN_RECORD, BYTE_MAX_RECORD, BYTE_CAPACITY);
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	pthread_create(&cons_thread, NULL, byte_consumer, &cbb);
+	pthread_create(&prod_thread, NULL, byte_producer, &cbb);
+	pthread_join(prod_thread, NULL);
+	pthread_join(cons_thread, &ret);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	uint32_t	total_errors = (uint32_t)(uintptr_t)ret;
+	double		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("Time:		%.3f s\n", elapsed);
+	printf("Throughput:	%.2f M msg/s\n", MSG_COUNT / elapsed / 1e6);
+
+	if (total_errors == 0)
+		printf("OK: all records received correctly\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbb_free(&cbb);
+	return (total_errors);
+}
+
+/* -- Socket I/O: datagrams through cb_sendmmsg / cb_recvmmsg and a byte
+   stream through cbb_write / cbb_read over socketpairs, both rings
+   refilled until everything crossed and checked on the way out. -- */
+
+static uint32_t io_datagram_size(uint32_t i) { return ((i * 7) % (IO_DGRAM_MAX + 1)); } // Includes empty ones
+
+static uint32_t run_io_datagrams(Allocator alloc)
+{
+	CircularBufferConfig	cfg = { .capacity = IO_SLOTS, .slot_size = sizeof(CbDatagram) + IO_DGRAM_MAX };
+	CircularBuffer			tx;
+	CircularBuffer			rx;
+	int						sv[2];
+	uint32_t				sent = 0;
+	uint32_t				queued = 0;
+	uint32_t				received = 0;
+	uint32_t				total_errors = 0;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) != 0)
+	{
+		perror("socketpair");
+		return (1);
+	}
+	if (cb_init_ex(&tx, alloc, &cfg) != 0 || cb_init_ex(&rx, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cb_init_ex failed\n");
+		return (1);
+	}
+
+	printf("Mode:          datagrams over a socketpair, %d slots of %d bytes\n", IO_SLOTS, IO_DGRAM_MAX);
+	if (cb_sendmmsg(&tx, sv[0], IO_SLOTS, 0) != -ENOBUFS || cb_recvmmsg(&rx, sv[1], IO_SLOTS, MSG_DONTWAIT) != -EAGAIN)
+		total_errors++;
+	while (received < IO_DATAGRAMS && total_errors == 0)
+	{
+		cb_seq_t	pos;
+		CbDatagram	*dg;
+
+		while (queued < IO_DATAGRAMS && (dg = (CbDatagram *)cb_push_claim(&tx, &pos)) != NULL)
+		{
+			dg->len = io_datagram_size(queued);
+			for (uint32_t j = 0; j < dg->len; ++j)
+				dg->data[j] = (uint8_t)(queued + j);
+			cb_push_publish(&tx, pos);
+			queued++;
+		}
+		int r = cb_sendmmsg(&tx, sv[0], IO_SEND_BATCH, MSG_DONTWAIT);
+		if (r > 0)
+			sent += (uint32_t)r;
+		else if (r != -ENOBUFS)
+			total_errors++;
+		while ((r = cb_recvmmsg(&rx, sv[1], IO_SLOTS, MSG_DONTWAIT)) > 0)
+			;
+		if (r != -EAGAIN && r != -ENOBUFS)
+		{
+			fprintf(stderr, "ERROR: cb_recvmmsg returned %d\n", r);
+			total_errors++;
+		}
+		while ((dg = (CbDatagram *)cb_pop_claim(&rx, &pos)) != NULL)
+		{
+			int ok = (dg->len == io_datagram_size(received));
+			for (uint32_t j = 0; ok && j < dg->len; ++j)
+				ok = (dg->data[j] == (uint8_t)(received + j));
+			if (!ok && total_errors++ < 10)
+				fprintf(stderr, "ERROR: datagram %u corrupt (len %u)\n", received, dg->len);
+			cb_pop_release(&rx, pos);
+			received++;
+		}
+	}
+	if (sent != IO_DATAGRAMS || cb_recvmmsg(&rx, sv[1], IO_SLOTS, MSG_DONTWAIT) != -EAGAIN
+			|| cb_pop_claim(&rx, &(cb_seq_t){ 0 }) != NULL)
+		total_errors++; // Nothing left over, and the failed call handed its slots back
+
+	if (total_errors == 0)
+		printf("OK: %d datagrams round-tripped\n\n", IO_DATAGRAMS);
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	close(sv[0]);
+	close(sv[1]);
+	cb_free(&tx);
+	cb_free(&rx);
+	return (total_errors);
+}
+
+static uint32_t run_io_stream(Allocator alloc)
+{
+	CircularByteBuffer	tx;
+	CircularByteBuffer	rx;
+	uint8_t				buf[BYTE_MAX_RECORD];
+	int					sv[2];
+	uint32_t			offset = 0;
+	uint32_t			queued = 0;
+	uint32_t			records = 0;
+	uint32_t			written = 0;
+	uint32_t			checked = 0;
+	uint32_t			total_errors = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+	{
+		perror("socketpair");
+		return (1);
+	}
+	if (cbb_init_ex(&tx, alloc, BYTE_CAPACITY, 0) != 0 || cbb_init_ex(&rx, alloc, BYTE_CAPACITY, 0) != 0)
+	{
+		fprintf(stderr, "cbb_init_ex failed\n");
+		return (1);
+	}
+
+	printf("Mode:          byte stream over a socketpair, %d bytes\n", IO_STREAM_BYTES);
+	if (cbb_write(&tx, sv[0], &offset) != -ENOBUFS || cbb_recv(&rx, sv[1], BYTE_MAX_RECORD, MSG_DONTWAIT) != -EAGAIN)
+		total_errors++;
+	while (checked < IO_STREAM_BYTES && total_errors == 0)
+	{
+		while (queued < IO_STREAM_BYTES)
+		{
+			uint32_t size = byte_record_size(records);
+			if (size > IO_STREAM_BYTES - queued)
+				size = IO_STREAM_BYTES - queued;
+			for (uint32_t j = 0; j < size; ++j)
+				buf[j] = (uint8_t)((queued + j) * 131);
+			if (cbb_push(&tx, buf, size) != 0)
+				break;
+			queued += size;
+			records++;
+		}
+		// Write what was read back, so the socket never holds more than rx can take
+		int r = 0;
+		while (written - checked < BYTE_CAPACITY / 2 && (r = cbb_write(&tx, sv[0], &offset)) >= 0)
+			written += (uint32_t)r;
+		if (r < 0 && r != -ENOBUFS)
+			total_errors++;
+		while (checked < written)
+		{
+			uint32_t size;
+
+			// Stream reads split and merge records freely: only the bytes count
+			if ((r = cbb_read(&rx, sv[1], BYTE_MAX_RECORD)) <= 0 || cbb_pop(&rx, buf, sizeof(buf), &size) != 0)
+			{
+				fprintf(stderr, "ERROR: cbb_read returned %d\n", r);
+				total_errors++;
+				break;
+			}
+			for (uint32_t j = 0; j < size; ++j)
+				if (buf[j] != (uint8_t)((checked + j) * 131) && total_errors++ < 10)
+					fprintf(stderr, "ERROR: stream byte %u corrupt\n", checked + j);
+			checked += size;
+		}
+	}
+	if (checked != IO_STREAM_BYTES || cbb_recv(&rx, sv[1], BYTE_MAX_RECORD, MSG_DONTWAIT) != -EAGAIN)
+		total_errors++;
+	close(sv[0]);
+	if (cbb_read(&rx, sv[1], BYTE_MAX_RECORD) != 0 || cbb_recv(&rx, sv[1], BYTE_MAX_RECORD, 0) != 0
+			|| cbb_pop(&rx, buf, sizeof(buf), &(uint32_t){ 0 }) == 0)
+		total_errors++; // EOF publishes nothing
+
+	if (total_errors == 0)
+		printf("OK: %u records round-tripped as %d bytes\n\n", records, IO_STREAM_BYTES);
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	close(sv[1]);
+	cbb_free(&tx);
+	cbb_free(&rx);
+	return (total_errors);
+}
+
+/* -- io_uring: records written back to back into a temp file through
+   WRITE_FIXED, then read back through READ_FIXED in slot-sized chunks
+   and checked byte by byte. Skipped where io_uring is unavailable. -- */
+
+/* Moves count slots through cb by plain push/pop, leaving it empty but
+   with head and tail away from 0. */
+static uint32_t uring_warm(CircularBuffer *cb, uint32_t count)
+{
+	uint8_t		buf[sizeof(CbDatagram) + IO_DGRAM_MAX] = { 0 };
+	uint32_t	errors = 0;
+
+	for (uint32_t i = 0; i < count; ++i)
+		errors += (cb_push(cb, buf, sizeof(buf)) != 0 || cb_pop(cb, buf, sizeof(buf)) != 0);
+	return (errors);
+}
+
+static uint32_t run_uring(Allocator alloc, uint32_t warmup)
+{
+	CircularBufferConfig	cfg = { .capacity = IO_SLOTS, .slot_size = sizeof(CbDatagram) + IO_DGRAM_MAX };
+	CircularBuffer			tx;
+	CircularBuffer			rx;
+	CbUring					u;
+	CbDatagram				*dg;
+	cb_seq_t				pos;
+	char					path[64];
+	uint32_t				queued = 0;
+	uint32_t				bytes = 0;
+	uint32_t				checked = 0;
+	uint32_t				total_errors = 0;
+	int						err;
+
+	if (cb_init_ex(&tx, alloc, &cfg) != 0 || cb_init_ex(&rx, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cb_init_ex failed\n");
+		return (1);
+	}
+	snprintf(path, sizeof(path), "/tmp/circbuf_test_uring.%d", (int)getpid());
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	printf("Mode:          io_uring, %d records through %s, after %u slots of other traffic\n",
+		URING_RECORDS, path, warmup);
+	total_errors += uring_warm(&tx, warmup) + uring_warm(&rx, warmup);
+	if (fd < 0 || (err = cb_uring_init(&u, &tx, alloc, URING_BATCH)) != 0)
+	{
+		err = fd < 0 ? -errno : err;
+		cb_free(&tx);
+		cb_free(&rx);
+		if (fd >= 0)
+			close(fd);
+		unlink(path);
+		if (err == -ENOSYS || err == -EPERM)
+		{
+			printf("SKIPPED: io_uring unavailable (%d)\n\n", err);
+			return (0);
+		}
+		fprintf(stderr, "cb_uring_init failed: %d\n", err);
+		return (1);
+	}
+
+	// Writer: the adapter is tx's only consumer
+	u.file_off = 0;
+	while (queued < URING_RECORDS || u.next != u.end || cb_size_approx(&tx) != 0)
+	{
+		while (queued < URING_RECORDS && (dg = (CbDatagram *)cb_push_claim(&tx, &pos)) != NULL)
+		{
+			dg->len = io_datagram_size(queued++);
+			for (uint32_t j = 0; j < dg->len; ++j)
+				dg->data[j] = (uint8_t)((bytes + j) * 131);
+			bytes += dg->len;
+			cb_push_publish(&tx, pos);
+		}
+		if ((err = cb_uring_write(&u, fd, URING_BATCH)) < 0 && err != -ENOBUFS)
+			break;
+		if ((err = cb_uring_reap(&u, 1)) < 0)
+			break;
+	}
+	if (err < 0 || u.last_error != 0)
+	{
+		fprintf(stderr, "ERROR: io_uring write: %d, last_error %d\n", err, u.last_error);
+		total_errors++;
+	}
+	cb_uring_free(&u);
+
+	// Reader: linked batches at the file position
+	if (total_errors == 0 && (lseek(fd, 0, SEEK_SET) != 0 || (err = cb_uring_init(&u, &rx, alloc, URING_BATCH)) != 0))
+		total_errors++;
+	for (int eof = 0; total_errors == 0 && !eof; )
+	{
+		if (((err = cb_uring_read(&u, fd, URING_BATCH)) < 0 && err != -ENOBUFS)
+				|| (err = cb_uring_reap(&u, 1)) < 0)
+		{
+			fprintf(stderr, "ERROR: io_uring read: %d\n", err);
+			total_errors++;
+		}
+		while ((dg = (CbDatagram *)cb_pop_claim(&rx, &pos)) != NULL)
+		{
+			eof |= (dg->len == 0);
+			for (uint32_t j = 0; j < dg->len; ++j)
+				if (dg->data[j] != (uint8_t)((checked + j) * 131) && total_errors++ < 10)
+					fprintf(stderr, "ERROR: file byte %u corrupt\n", checked + j);
+			checked += dg->len;
+			cb_pop_release(&rx, pos);
+		}
+	}
+	if (total_errors == 0 && (checked != bytes || u.last_error != 0))
+		total_errors++;
+	cb_uring_free(&u); // No-op if already freed, or never set up again
+
+	if (total_errors == 0)
+		printf("OK: %u bytes written and read back\n\n", bytes);
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	close(fd);
+	unlink(path);
+	cb_free(&tx);
+	cb_free(&rx);
+	return (total_errors);
+}
+
+/* A pattern trickled through a pipe while a batch of reads waits on it:
+   the bytes must come out in order, whichever reads the kernel wakes. */
+static uint32_t run_uring_pipe(Allocator alloc)
+{
+	CircularBufferConfig	cfg = { .capacity = IO_SLOTS, .slot_size = sizeof(CbDatagram) + IO_DGRAM_MAX };
+	CircularBuffer			rx;
+	CbUring					u;
+	CbDatagram				*dg;
+	cb_seq_t				pos;
+	uint8_t					buf[URING_PIPE_CHUNK];
+	int						p[2];
+	uint32_t				written = 0;
+	uint32_t				checked = 0;
+	uint32_t				total_errors = 0;
+	int						err;
+
+	if (cb_init_ex(&rx, alloc, &cfg) != 0 || pipe(p) != 0)
+	{
+		fprintf(stderr, "cb_init_ex or pipe failed\n");
+		return (1);
+	}
+	printf("Mode:          io_uring, %d bytes through a pipe, %d reads in flight\n",
+		IO_STREAM_BYTES, URING_BATCH);
+	if ((err = cb_uring_init(&u, &rx, alloc, URING_BATCH)) != 0)
+	{
+		close(p[0]);
+		close(p[1]);
+		cb_free(&rx);
+		if (err == -ENOSYS || err == -EPERM)
+		{
+			printf("SKIPPED: io_uring unavailable (%d)\n\n", err);
+			return (0);
+		}
+		fprintf(stderr, "cb_uring_init failed: %d\n", err);
+		return (1);
+	}
+	for (int eof = 0; total_errors == 0 && !eof; )
+	{
+		// Queue first, so the reads are waiting when the bytes arrive
+		if ((err = cb_uring_read(&u, p[0], URING_BATCH)) < 0 && err != -ENOBUFS)
+			total_errors++;
+		if (written < IO_STREAM_BYTES)
+		{
+			uint32_t size = IO_STREAM_BYTES - written < URING_PIPE_CHUNK ? IO_STREAM_BYTES - written : URING_PIPE_CHUNK;
+
+			for (uint32_t j = 0; j < size; ++j)
+				buf[j] = (uint8_t)((written + j) * 131);
+			if (write(p[1], buf, size) != (ssize_t)size)
+				total_errors++;
+			written += size;
+			if (written == IO_STREAM_BYTES)
+				close(p[1]); // The reads still queued see EOF
+		}
+		if ((err = cb_uring_reap(&u, 1)) < 0)
+		{
+			fprintf(stderr, "ERROR: io_uring read: %d\n", err);
+			total_errors++;
+		}
+		while ((dg = (CbDatagram *)cb_pop_claim(&rx, &pos)) != NULL)
+		{
+			eof |= (dg->len == 0);
+			for (uint32_t j = 0; j < dg->len; ++j)
+				if (dg->data[j] != (uint8_t)((checked + j) * 131) && total_errors++ < 10)
+					fprintf(stderr, "ERROR: pipe byte %u out of order\n", checked + j);
+			checked += dg->len;
+			cb_pop_release(&rx, pos);
+		}
+	}
+	if (total_errors == 0 && (checked != IO_STREAM_BYTES || u.last_error != 0))
+		total_errors++;
+
+	if (total_errors == 0)
+		printf("OK: %d bytes read back in order\n\n", IO_STREAM_BYTES);
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cb_uring_free(&u);
+	if (written < IO_STREAM_BYTES)
+		close(p[1]);
+	close(p[0]);
+	cb_free(&rx);
+	return (total_errors);
+}
+
+/* -- Layouts: cb_index must map every position of a lap to a distinct
+   slot, and repeat with the lap, for every layout and a range of
+   capacities and slot sizes. -- */
+
+static uint32_t run_layout_index(Allocator alloc)
+{
+	static const uint32_t	slot_sizes[] = { 1, 4, 20, 60, 200 };
+	uint32_t				total_errors = 0;
+	uint32_t				swizzled = 0;	// rings whose mapping is not the identity
+	uint8_t					*seen = malloc(INDEX_MAX_CAPACITY);
+
+	printf("Mode:          slot index mapping, capacities 2..%d\n", INDEX_MAX_CAPACITY);
+	for (uint32_t l = CB_LAYOUT_PACKED; l <= CB_LAYOUT_SWIZZLED; ++l)
+	for (uint32_t capacity = 2; capacity <= INDEX_MAX_CAPACITY; capacity <<= 1)
+	for (size_t z = 0; z < sizeof(slot_sizes) / sizeof(slot_sizes[0]); ++z)
+	{
+		CircularBuffer			cb;
+		CircularBufferConfig	cfg = { .capacity = capacity, .slot_size = slot_sizes[z], .layout = (CbLayout)l };
+
+		if (cb_init_ex(&cb, alloc, &cfg) != 0)
+		{
+			fprintf(stderr, "cb_init_ex failed\n");
+			total_errors++;
+			continue;
+		}
+		memset(seen, 0, capacity);
+		swizzled += cb.swz_bits != 0;
+		for (uint32_t pos = 0; pos < capacity; ++pos)
+		{
+			uint32_t idx = cb_index(&cb, pos);
+
+			if (idx >= capacity || seen[idx]++ || cb_index(&cb, pos + capacity) != idx
+					|| (l != CB_LAYOUT_SWIZZLED && idx != pos)
+					|| (uintptr_t)cb_slot_data(&cb, pos) % CIRCBUF_SLOT_ALIGN != 0)
+			{
+				if (total_errors++ < 10)
+					fprintf(stderr, "ERROR: layout %u, capacity %u, slot_size %u: position %u maps to slot %u\n",
+						l, capacity, slot_sizes[z], pos, idx);
+				break;
+			}
+		}
+		cb_free(&cb);
+	}
+	free(seen);
+	if (swizzled == 0)
+	{
+		fprintf(stderr, "ERROR: no swizzled ring remapped its positions\n");
+		total_errors++;
+	}
+
+	if (total_errors == 0)
+		printf("OK: every position maps to its own, aligned slot\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+	return (total_errors);
+}
+
+/* -- Mmap allocator: alignment, writable size and free for every flag
+   combination; MMAP_ALLOC_HUGE must hand out 2 MB-aligned mappings
+   whether or not the system has hugetlb pages (it falls back to THP). -- */
+
+static uint32_t run_mmap_alloc(void)
+{
+	static const uint32_t	flag_sets[] = { 0, MMAP_ALLOC_POPULATE, MMAP_ALLOC_HUGE, MMAP_ALLOC_HUGE | MMAP_ALLOC_POPULATE };
+	static const size_t		sizes[] = { 1, 4096, 3 * 4096 + 5, 3u << 20 };
+	static const size_t		aligns[] = { 0, 8, 64, 4096 };
+	uint32_t				total_errors = 0;
+	void					*probe = mmap(NULL, MMAP_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	printf("Mode:          mmap allocator, huge pages via %s\n",
+		probe == MAP_FAILED ? "the MADV_HUGEPAGE fallback" : "MAP_HUGETLB");
+	if (probe != MAP_FAILED)
+		munmap(probe, MMAP_HUGE_PAGE_SIZE);
+	for (size_t f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]); ++f)
+	for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); ++z)
+	for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); ++a)
+	{
+		MmapAllocatorConfig	cfg = { .numa_node = -1, .flags = flag_sets[f] };
+		Allocator			alloc = mmap_allocator(&cfg);
+		uint8_t				*p = alloc.alloc(alloc.ctx, sizes[z], aligns[a]);
+		size_t				want = aligns[a] > 64 ? aligns[a] : 64;
+
+		if (!p || (uintptr_t)p % want != 0)
+		{
+			fprintf(stderr, "ERROR: mmap_alloc(%zu, %zu) flags %u returned %p\n", sizes[z], aligns[a], flag_sets[f], (void *)p);
+			total_errors++;
+			continue;
+		}
+		MmapHeader *hdr = (MmapHeader *)p - 1;
+		if ((flag_sets[f] & MMAP_ALLOC_HUGE) && ((uintptr_t)hdr->base % MMAP_HUGE_PAGE_SIZE != 0
+				|| hdr->length % MMAP_HUGE_PAGE_SIZE != 0))
+		{
+			fprintf(stderr, "ERROR: huge mapping %p + %zu is not 2 MB-aligned\n", hdr->base, hdr->length);
+			total_errors++;
+		}
+		memset(p, 0xa5, sizes[z]); // Faults if the mapping is short
+		alloc.free(alloc.ctx, p);
+	}
+
+	// A node past the mbind mask is refused, not written past it
+	MmapAllocatorConfig		bad = { .numa_node = MMAP_NUMA_NODES, .flags = 0 };
+	Allocator				bad_alloc = mmap_allocator(&bad);
+
+	if (bad_alloc.alloc(bad_alloc.ctx, 4096, 0) != NULL)
+	{
+		fprintf(stderr, "ERROR: mmap_alloc accepted numa_node %d\n", MMAP_NUMA_NODES);
+		total_errors++;
+	}
+
+	// A whole ring on populated pages
+	MmapAllocatorConfig		cfg = { .numa_node = -1, .flags = MMAP_ALLOC_POPULATE };
+	CircularBufferConfig	ring_cfg = { .capacity = MMAP_CAPACITY, .slot_size = sizeof(Message) };
+	CircularBuffer			cb;
+	Message					msg;
+
+	if (cb_init_ex(&cb, mmap_allocator(&cfg), &ring_cfg) != 0)
+		total_errors++;
+	else
+	{
+		for (uint32_t i = 0; i < 3 * MMAP_CAPACITY; ++i)
+		{
+			Message in = { .seq = i, .value = (uint64_t)i * 31337 };
+			if (cb_push(&cb, &in, sizeof(in)) != 0 || cb_pop(&cb, &msg, sizeof(msg)) != 0 || msg.seq != i)
+			{
+				total_errors++;
+				break;
+			}
+		}
+		cb_free(&cb);
+	}
+
+	if (total_errors == 0)
+		printf("OK: every allocation aligned, usable and freed\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+	return (total_errors);
+}
+
+/* -- Watermarks: one thread walks an SPSC ring up and down so every
+   crossing, and every check, happens at a known position. -- */
+
+typedef struct {
+	uint32_t	fired[2];	// [0] low, [1] high
+	uint32_t	size;		// cb_size_approx at the last callback
+} WatermarkLog;
+
+static void watermark_cb(CircularBuffer *cb, int high, void *ctx)
+{
+	WatermarkLog *log = (WatermarkLog *)ctx;
+
+	log->fired[high != 0]++;
+	log->size = cb_size_approx(cb);
+}
+
+/* Pushes or pops until the ring holds target messages; counts sizes
+   outside [0, capacity] seen on the way. */
+static uint32_t watermark_fill(CircularBuffer *cb, uint32_t target)
+{
+	Message		msg = { 0 };
+	uint32_t	errors = 0;
+
+	while (cb_size_approx(cb) != target)
+	{
+		if (cb_size_approx(cb) < target ? cb_push(cb, &msg, sizeof(msg)) : cb_pop(cb, &msg, sizeof(msg)))
+			return (errors + 1);
+		errors += cb_size_approx(cb) > WM_CAPACITY;
+	}
+	return (errors);
+}
+
+static uint32_t watermark_expect(const WatermarkLog *log, uint32_t low, uint32_t high, uint32_t size, const char *step)
+{
+	if (log->fired[0] == low && log->fired[1] == high && (size == 0 || log->size == size))
+		return (0);
+	fprintf(stderr, "ERROR: watermarks after %s: %u low, %u high at size %u (expected %u, %u at %u)\n",
+		step, log->fired[0], log->fired[1], log->size, low, high, size);
+	return (1);
+}
+
+static uint32_t run_watermarks(Allocator alloc)
+{
+	WatermarkLog			log = { { 0, 0 }, 0 };
+	CircularBufferConfig	cfg = {
+		.capacity = WM_CAPACITY,
+		.slot_size = sizeof(Message),
+		.high_watermark = WM_HIGH,
+		.low_watermark = WM_LOW,
+		.watermark_interval = WM_INTERVAL,
+		.on_watermark = watermark_cb,
+		.watermark_ctx = &log,
+	};
+	CircularBuffer			cb;
+	Message					msg = { 0 };
+	uint32_t				total_errors = 0;
+
+	if (cb_init_ex(&cb, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cb_init_ex failed\n");
+		return (1);
+	}
+
+	printf("Mode:          watermarks, capacity %d, high %d, low %d, checked every %d\n",
+		WM_CAPACITY, WM_HIGH, WM_LOW, WM_INTERVAL);
+	total_errors += watermark_fill(&cb, WM_HIGH);
+	total_errors += watermark_expect(&log, 0, 0, 0, "reaching the high mark between checks");
+	total_errors += watermark_fill(&cb, 48);
+	total_errors += watermark_expect(&log, 0, 1, 48, "the next check");
+	total_errors += watermark_fill(&cb, WM_CAPACITY);
+	if (cb_push(&cb, &msg, sizeof(msg)) != -1 || cb_size_approx(&cb) != WM_CAPACITY)
+		total_errors++;
+	total_errors += watermark_expect(&log, 0, 1, 48, "filling up");
+	total_errors += watermark_fill(&cb, WM_LOW);
+	total_errors += watermark_expect(&log, 0, 1, 48, "reaching the low mark between checks");
+	total_errors += watermark_fill(&cb, 16);
+	total_errors += watermark_expect(&log, 1, 1, 16, "the next check");
+	// Hysteresis: back up short of the high mark and down again fires nothing
+	total_errors += watermark_fill(&cb, 40);
+	total_errors += watermark_fill(&cb, 8);
+	total_errors += watermark_expect(&log, 1, 1, 16, "a swing between the marks");
+	total_errors += watermark_fill(&cb, WM_CAPACITY);
+	total_errors += watermark_expect(&log, 1, 2, 0, "a second fill");
+	total_errors += watermark_fill(&cb, 0);
+	if (cb_pop(&cb, &msg, sizeof(msg)) != -1)
+		total_errors++;
+	total_errors += watermark_expect(&log, 2, 2, 0, "draining");
+
+	if (total_errors == 0)
+		printf("OK: every crossing reported once, at a check\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cb_free(&cb);
+	return (total_errors);
+}
+
+/* -- Bulk copy: records of BULK_RECORD bytes through cb_push_bulk /
+   cb_pop_bulk, in every layout, with and without streaming stores. -- */
+
+typedef struct {
+	CircularBuffer	*cb;
+	uint32_t		flags;
+} BulkArgs;
+
+static void *bulk_producer(void *arg)
+{
+	BulkArgs	*args = (BulkArgs *)arg;
+	uint8_t		buf[BULK_COUNT * BULK_RECORD];
+
+	for (uint32_t i = 0; i < MSG_COUNT; )
+	{
+		uint32_t want = MSG_COUNT - i < BULK_COUNT ? MSG_COUNT - i : BULK_COUNT;
+		for (uint32_t r = 0; r < want; ++r)
+			for (uint32_t j = 0; j < BULK_RECORD; ++j)
+				buf[r * BULK_RECORD + j] = (uint8_t)(i + r + j);
+		i += cb_push_bulk(args->cb, buf, BULK_RECORD, want, args->flags);
+	}
+	return (NULL);
+}
+
+static void *bulk_consumer(void *arg)
+{
+	BulkArgs	*args = (BulkArgs *)arg;
+	uint8_t		buf[BULK_COUNT * BULK_RECORD];
+	uint32_t	errors = 0;
+
+	for (uint32_t i = 0; i < MSG_COUNT; )
+	{
+		uint32_t n = cb_pop_bulk(args->cb, buf, BULK_RECORD, BULK_COUNT, args->flags);
+		for (uint32_t r = 0; r < n; ++r, ++i)
+		{
+			int ok = 1;
+			for (uint32_t j = 0; ok && j < BULK_RECORD; ++j)
+				ok = (buf[r * BULK_RECORD + j] == (uint8_t)(i + j));
+			if (!ok && errors++ < 10)
+				fprintf(stderr, "ERROR: bulk record %u corrupt\n", i);
+		}
+	}
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_bulk(Allocator alloc, CbLayout layout, uint32_t flags, uint32_t cb_flags)
+{
+	static const char		*layout_names[] = { "packed", "padded", "swizzled" };
+	CircularBuffer			cb;
+	CircularBufferConfig	cfg = { .capacity = CAPACITY, .slot_size = BULK_RECORD, .layout = layout,
+		.flags = cb_flags };
+	BulkArgs				args = { .cb = &cb, .flags = flags };
+	pthread_t				prod_thread;
+	pthread_t				cons_thread;
+	void					*ret;
+	uint32_t				total_errors = 0;
+
+	if (cb_init_ex(&cb, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cb_init_ex failed\n");
+		return (1);
+	}
+
+	printf("Mode:          SPSC bulk, %s%s%s\n", layout_names[layout], flags & CB_BULK_STREAM ? ", streaming" : "",
+		cb_flags & CB_FLAG_MIRRORED ? ", mirrored" : "");
+	if (cb_flags & CB_FLAG_MIRRORED)
+	{
+		uint32_t	span;
+		uint8_t		*last = cb_slot_span(&cb, CAPACITY - 1, 2, &span);
+
+		// The run across the wrap is one span, and its second slot aliases slot 0
+		last[cb.stride] = 0x5a;
+		if (span != 2 || *(uint8_t *)cb_slot_data(&cb, 0) != 0x5a)
+		{
+			fprintf(stderr, "ERROR: cb_slot_span does not run across the wrap (span %u)\n", span);
+			total_errors++;
+		}
+	}
+	pthread_create(&cons_thread, NULL, bulk_consumer, &args);
+	pthread_create(&prod_thread, NULL, bulk_producer, &args);
+	pthread_join(prod_thread, NULL);
+	pthread_join(cons_thread, &ret);
+
+	total_errors += (uint32_t)(uintptr_t)ret;
+	if (total_errors == 0)
+		printf("OK: all records received correctly\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cb_free(&cb);
+	return (total_errors);
+}
+
+/* -- Sharded: MAX_THREADS producers, each on its own shard, and
+   MAX_THREADS consumers that steal. In FIFO mode each consumer also
+   checks that a shard's messages come out in order. -- */
+
+typedef struct {
+	CircularShardedBuffer	*s;
+	uint32_t				shard;
+	uint32_t				start_seq;
+	uint32_t				count;
+	_Atomic uint32_t		*consumed;
+	_Atomic uint8_t			*received_tracker;
+	uint32_t				*last_seq;	// per shard, only touched by the shard's owner
+} ShardArgs;
+
+static void *shard_producer(void *arg)
+{
+	ShardArgs *args = (ShardArgs *)arg;
+
+	for (uint32_t i = 0; i < args->count; ++i)
+	{
+		uint32_t seq = args->start_seq + i;
+		Message msg = { .seq = seq, .value = (uint64_t)seq * 31337 };
+		while (cbs_push(args->s, args->shard, &msg, sizeof(msg)) != 0)
+			; /* spin until slot available */
+	}
+	return (NULL);
+}
+
+static void *shard_consumer(void *arg)
+{
+	ShardArgs	*args = (ShardArgs *)arg;
+	ConsArgs	check = { .received_tracker = args->received_tracker };
+	uint32_t	errors = 0;
+
+	while (atomic_load_explicit(args->consumed, memory_order_relaxed) < MSG_COUNT)
+	{
+		uint32_t	shard;
+		cb_seq_t	pos;
+		uint32_t	n = cbs_pop_claim(args->s, args->shard, BATCH_SIZE, &shard, &pos);
+
+		for (uint32_t j = 0; j < n; ++j)
+		{
+			const Message *m = cb_slot_data(cbs_shard(args->s, shard), pos + j);
+			if ((args->s->flags & CB_SHARD_FIFO) && m->seq != args->last_seq[shard]++)
+			{
+				if (errors < 10)
+					fprintf(stderr, "ERROR: shard %u out of order at seq %u\n", shard, m->seq);
+				errors++;
+			}
+			errors += check_message(&check, m);
+		}
+		if (n)
+		{
+			cbs_pop_release(args->s, shard, pos, n);
+			atomic_fetch_add_explicit(args->consumed, n, memory_order_relaxed);
+		}
+	}
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_sharded(Allocator alloc, uint32_t flags, _Atomic uint8_t *received_tracker)
+{
+	CircularShardedBuffer	s;
+	CbShardConfig			cfg = {
+		.count = MAX_THREADS,
+		.capacity = CAPACITY,
+		.slot_size = sizeof(Message),
+		.flags = flags,
+	};
+	pthread_t				prod_threads[MAX_THREADS];
+	pthread_t				cons_threads[MAX_THREADS];
+	ShardArgs				prod_args[MAX_THREADS];
+	ShardArgs				cons_args[MAX_THREADS];
+	uint32_t				last_seq[MAX_THREADS];
+	_Atomic uint32_t		consumed = 0;
+	uint32_t				msg_per_prod = MSG_COUNT / MAX_THREADS;
+
+	if (cbs_init(&s, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cbs_init failed\n");
+		return (1);
+	}
+	memset((void *)received_tracker, 0, MSG_COUNT * sizeof(_Atomic uint8_t));
+
+	printf("Mode:          sharded, %d shards, work stealing%s\n", MAX_THREADS,
+		flags & CB_SHARD_FIFO ? ", FIFO per shard" : "");
+	for (int i = 0; i < MAX_THREADS; ++i)
+	{
+		last_seq[i] = i * msg_per_prod;
+		cons_args[i] = (ShardArgs){ .s = &s, .shard = i, .consumed = &consumed,
+			.received_tracker = received_tracker, .last_seq = last_seq };
+		pthread_create(&cons_threads[i], NULL, shard_consumer, &cons_args[i]);
+	}
+	for (int i = 0; i < MAX_THREADS; ++i)
+	{
+		prod_args[i] = (ShardArgs){ .s = &s, .shard = i, .start_seq = i * msg_per_prod,
+			.count = msg_per_prod };
+		pthread_create(&prod_threads[i], NULL, shard_producer, &prod_args[i]);
+	}
+
+	uint32_t total_errors = 0;
+	for (int i = 0; i < MAX_THREADS; ++i)
+		pthread_join(prod_threads[i], NULL);
+	for (int i = 0; i < MAX_THREADS; ++i)
+	{
+		void *ret;
+		pthread_join(cons_threads[i], &ret);
+		total_errors += (uint32_t)(uintptr_t)ret;
+	}
+	for (uint32_t i = 0; i < MSG_COUNT && total_errors <= 10; ++i)
+	{
+		if (atomic_load_explicit(&received_tracker[i], memory_order_relaxed) != 1)
+		{
+			if (total_errors == 0)
+				fprintf(stderr, "ERROR: Missing message seq %u\n", i);
+			total_errors++;
+		}
+	}
+
+	if (total_errors == 0)
+		printf("OK: all messages received correctly\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbs_free(&s);
+	return (total_errors);
+}
+
+/* -- Broadcast: one producer, BCAST_READERS readers that must each see
+   every message in order. -- */
+
+typedef struct {
+	CircularBroadcast	*bc;
+	int					id;
+} BcastArgs;
+
+static void *bcast_producer(void *arg)
+{
+	CircularBroadcast *bc = (CircularBroadcast *)arg;
+
+	for (uint32_t i = 0; i < MSG_COUNT; ++i)
+	{
+		Message msg = { .seq = i, .value = (uint64_t)i * 31 };
+		while (cbcast_push(bc, &msg, sizeof(msg)) != 0)
+			; /* spin until the slowest reader frees a slot */
+	}
+	return (NULL);
+}
+
+static void *bcast_reader(void *arg)
+{
+	BcastArgs	*args = (BcastArgs *)arg;
+	uint32_t	errors = 0;
+
+	for (uint32_t i = 0; i < MSG_COUNT; )
+	{
+		cb_seq_t	pos;
+		uint32_t	n = cbcast_read_claim_n(args->bc, args->id, BATCH_SIZE, &pos);
+
+		for (uint32_t k = 0; k < n; ++k, ++i)
+		{
+			const Message *m = cbcast_slot_data(args->bc, pos + k);
+			if ((m->seq != i || m->value != (uint64_t)i * 31) && errors++ < 10)
+				fprintf(stderr, "ERROR: reader %d got seq %u, expected %u\n", args->id, m->seq, i);
+		}
+		if (n)
+			cbcast_read_release_n(args->bc, args->id, pos, n);
+	}
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_broadcast(Allocator alloc)
+{
+	CircularBroadcast	bc;
+	BcastArgs			args[BCAST_READERS];
+	pthread_t			prod_thread;
+	pthread_t			readers[BCAST_READERS];
+	uint32_t			total_errors = 0;
+
+	if (cbcast_init(&bc, alloc, CAPACITY, sizeof(Message), BCAST_READERS) != 0)
+	{
+		fprintf(stderr, "cbcast_init failed\n");
+		return (1);
+	}
+
+	printf("Mode:          broadcast, 1 producer, %d readers\n", BCAST_READERS);
+	for (int r = 0; r < BCAST_READERS; ++r)
+	{
+		args[r].bc = &bc;
+		args[r].id = cbcast_subscribe(&bc);
+		pthread_create(&readers[r], NULL, bcast_reader, &args[r]);
+	}
+	if (cbcast_subscribe(&bc) != -EBUSY)
+		total_errors++;
+	pthread_create(&prod_thread, NULL, bcast_producer, &bc);
+	pthread_join(prod_thread, NULL);
+	for (int r = 0; r < BCAST_READERS; ++r)
+	{
+		void *ret;
+		pthread_join(readers[r], &ret);
+		total_errors += (uint32_t)(uintptr_t)ret;
+	}
+
+	if (total_errors == 0)
+		printf("OK: all readers received every message\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbcast_free(&bc);
+	return (total_errors);
+}
+
+/* -- Overwrite: the producer never waits; a fast and a slow reader must
+   see increasing, untorn messages and account for every one they miss. -- */
+
+typedef struct {
+	CircularOverwriteBuffer	*o;
+	int						slow;
+	uint64_t				received;
+	uint64_t				dropped;
+} LossyArgs;
+
+static void *lossy_producer(void *arg)
+{
+	CircularOverwriteBuffer *o = (CircularOverwriteBuffer *)arg;
+
+	for (uint32_t i = 0; i < MSG_COUNT; ++i)
+	{
+		Message msg = { .seq = i, .value = (uint64_t)i * 31 };
+		cbo_push(o, &msg, sizeof(msg));
+	}
+	return (NULL);
+}
+
+static void *lossy_reader(void *arg)
+{
+	LossyArgs			*args = (LossyArgs *)arg;
+	CbOverwriteReader	r = { 0 };	// From position 0, so received + dropped covers every message
+	uint32_t			errors = 0;
+	int64_t				last = -1;
+	Message				msg;
+
+	while (last != MSG_COUNT - 1)
+	{
+		if (cbo_read(args->o, &r, &msg, sizeof(msg)) != 0)
+			continue; /* spin until data available */
+		if (((int64_t)msg.seq <= last || msg.value != (uint64_t)msg.seq * 31) && errors++ < 10)
+			fprintf(stderr, "ERROR: overwrite reader got seq %u after %" PRId64 "\n", msg.seq, last);
+		last = msg.seq;
+		if (++args->received % LOSSY_STALL == 0 && args->slow)
+		{
+			struct timespec stall = { 0, 100000 };
+			nanosleep(&stall, NULL);
+		}
+	}
+	args->dropped = r.dropped;
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_overwrite(Allocator alloc)
+{
+	CircularOverwriteBuffer	o;
+	pthread_t				prod_thread;
+	pthread_t				readers[2];
+	LossyArgs				args[2];
+	uint32_t				total_errors = 0;
+	Message					msg;
+
+	if (cbo_init(&o, alloc, LOSSY_CAPACITY, sizeof(Message)) != 0)
+	{
+		fprintf(stderr, "cbo_init failed\n");
+		return (1);
+	}
+
+	printf("Mode:          overwrite, capacity %d, a fast and a slow reader\n", LOSSY_CAPACITY);
+	for (int i = 0; i < 2; ++i)
+	{
+		args[i] = (LossyArgs){ .o = &o, .slow = i };
+		pthread_create(&readers[i], NULL, lossy_reader, &args[i]);
+	}
+	pthread_create(&prod_thread, NULL, lossy_producer, &o);
+	pthread_join(prod_thread, NULL);
+	for (int i = 0; i < 2; ++i)
+	{
+		void *ret;
+		pthread_join(readers[i], &ret);
+		total_errors += (uint32_t)(uintptr_t)ret;
+		printf("Reader %d:      %" PRIu64 " received, %" PRIu64 " dropped\n", i, args[i].received, args[i].dropped);
+		if (args[i].received + args[i].dropped != MSG_COUNT)
+		{
+			fprintf(stderr, "ERROR: overwrite reader %d accounts for %" PRIu64 " of %d messages\n",
+				i, args[i].received + args[i].dropped, MSG_COUNT);
+			total_errors++;
+		}
+	}
+	if (args[1].dropped == 0)
+	{
+		fprintf(stderr, "ERROR: the slow reader never fell behind\n");
+		total_errors++;
+	}
+	if (cbo_latest(&o, &msg, sizeof(msg)) != 0 || msg.seq != MSG_COUNT - 1)
+	{
+		fprintf(stderr, "ERROR: cbo_latest did not return the last message\n");
+		total_errors++;
+	}
+
+	if (total_errors == 0)
+		printf("OK: every message received or counted as dropped\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbo_free(&o);
+	return (total_errors);
+}
+
+/* -- Shared memory: a forked child attaches by name (its own mapping, at
+   its own address) and produces; the parent consumes through the
+   creator's mapping. Then attach must refuse a segment whose version or
+   magic does not match. -- */
+
+static uint32_t run_shm(void)
+{
+	CircularBufferConfig	cfg = { .capacity = SHM_CAPACITY, .slot_size = sizeof(Message), .mode = CB_SPSC };
+	CbShm					shm;
+	CbShm					other;
+	char					name[64];
+	uint32_t				total_errors = 0;
+	int						status;
+	int						err;
+
+	snprintf(name, sizeof(name), "/circbuf_test.%d", (int)getpid());
+	cb_shm_unlink(name);
+	if ((err = cb_shm_create(&shm, name, &cfg)) != 0)
+	{
+		fprintf(stderr, "cb_shm_create failed: %d\n", err);
+		return (1);
+	}
+
+	printf("Mode:          shared memory (SPSC across processes), capacity %d, %s\n", SHM_CAPACITY, name);
+	fflush(stdout); // Or the child's exit would print it twice
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		if (cb_shm_attach(&other, name) != 0)
+			_exit(2);
+		for (uint32_t i = 0; i < SHM_MESSAGES; ++i)
+		{
+			Message msg = { .seq = i, .value = (uint64_t)i * 31337 };
+			if (cb_push_wait(other.cb, &msg, sizeof(msg), SHM_TIMEOUT_NS) != 0)
+				_exit(3);
+		}
+		cb_shm_detach(&other);
+		_exit(0);
+	}
+	if (pid < 0)
+	{
+		perror("fork");
+		total_errors++;
+	}
+	for (uint32_t i = 0; pid > 0 && i < SHM_MESSAGES; ++i)
+	{
+		Message msg;
+		if (cb_pop_wait(shm.cb, &msg, sizeof(msg), SHM_TIMEOUT_NS) != 0)
+		{
+			fprintf(stderr, "ERROR: timed out waiting for message %u\n", i);
+			total_errors++;
+			break;
+		}
+		if ((msg.seq != i || msg.value != (uint64_t)i * 31337) && total_errors++ < 10)
+			fprintf(stderr, "ERROR: message %u arrived as seq %u\n", i, msg.seq);
+	}
+	if (pid > 0 && (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0))
+	{
+		fprintf(stderr, "ERROR: producer process failed (status %d)\n", status);
+		total_errors++;
+	}
+
+	// A segment from another build, or one still being created
+	shm.seg->version = CB_SHM_VERSION + 1;
+	if ((err = cb_shm_attach(&other, name)) != -EPROTO)
+	{
+		fprintf(stderr, "ERROR: attach to a version %u segment returned %d\n", shm.seg->version, err);
+		total_errors++;
+	}
+	shm.seg->version = CB_SHM_VERSION;
+	atomic_store(&shm.seg->magic, 0);
+	if ((err = cb_shm_attach(&other, name)) != -EAGAIN)
+	{
+		fprintf(stderr, "ERROR: attach without the magic returned %d\n", err);
+		total_errors++;
+	}
+	atomic_store(&shm.seg->magic, CB_SHM_MAGIC);
+	if (cb_shm_attach(&other, name) != 0)
+		total_errors++;
+	cb_shm_detach(&other);
+	cb_shm_detach(&shm);
+	if (cb_shm_unlink(name) != 0 || cb_shm_attach(&other, name) != -ENOENT)
+		total_errors++;
+
+	if (total_errors == 0)
+		printf("OK: all messages received across processes, mismatched segments refused\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	return (total_errors);
+}
+
+/* -- Journal: fill a file-backed ring, consume part of it, drop the
+   mapping without releasing the rest (a crashed pair of processes),
+   reopen and check that exactly the uncommitted messages come back. -- */
+
+static uint32_t journal_push(CircularBuffer *cb, uint32_t first, uint32_t count)
+{
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		Message msg = { .seq = i, .value = (uint64_t)i * 31 };
+		if (cb_push(cb, &msg, sizeof(msg)) != 0)
+			return (1);
+	}
+	return (0);
+}
+
+static uint32_t run_journal(void)
+{
+	CircularBufferConfig	cfg = {
+		.capacity = JOURNAL_CAPACITY,
+		.slot_size = sizeof(Message),
+		.mode = CB_MPSC,
+	};
+	CbJournal				j;
+	char					path[64];
+	cb_seq_t				pos;
+	uint32_t				total_errors = 0;
+	Message					msg;
+	int						n;
+
+	snprintf(path, sizeof(path), "/tmp/circbuf_test_journal.%d", (int)getpid());
+	cbj_unlink(path);
+	if ((n = cbj_open(&j, path, &cfg, 16, 0)) != 0)
+	{
+		fprintf(stderr, "cbj_open failed: %d\n", n);
+		return (1);
+	}
+
+	printf("Mode:          journal (MPSC), capacity %d, %s\n", JOURNAL_CAPACITY, path);
+	// 0..19, two fillers, 20..29, a slot claimed and never published, 30
+	total_errors += journal_push(cbj_ring(&j), 0, 20);
+	cb_push_claim_n(cbj_ring(&j), 2, &pos);
+	cb_push_skip_n(cbj_ring(&j), pos, 2);
+	total_errors += journal_push(cbj_ring(&j), 20, 10);
+	cb_push_claim(cbj_ring(&j), &pos);
+	total_errors += journal_push(cbj_ring(&j), 30, 1);
+	for (uint32_t i = 0; i < JOURNAL_COMMIT; ++i)
+		if (cbj_pop(&j, &msg, sizeof(msg)) != 0 || msg.seq != i)
+			total_errors++;
+	cb_pop_claim(cbj_ring(&j), &pos); // Being processed when the consumer dies
+	cbj_close(&j);
+
+	CircularBufferConfig other = cfg;
+	other.capacity *= 2;
+	if ((n = cbj_open(&j, path, &other, 16, 0)) != -EPROTO)
+	{
+		fprintf(stderr, "ERROR: reopening with another capacity returned %d\n", n);
+		total_errors++;
+		if (n >= 0)
+			cbj_close(&j);
+	}
+	if ((n = cbj_open(&j, path, &cfg, 16, 0)) < 0)
+	{
+		fprintf(stderr, "ERROR: reopening the journal failed: %d\n", n);
+		cbj_unlink(path);
+		return (total_errors + 1);
+	}
+	printf("Recovered:     %d positions\n", n);
+	if (n != 30 - JOURNAL_COMMIT + 2)
+	{
+		fprintf(stderr, "ERROR: recovered %d positions, expected %d\n", n, 30 - JOURNAL_COMMIT + 2);
+		total_errors++;
+	}
+	for (uint32_t i = JOURNAL_COMMIT; i < 30; ++i)
+		if (cbj_pop(&j, &msg, sizeof(msg)) != 0 || msg.seq != i || msg.value != (uint64_t)i * 31)
+		{
+			fprintf(stderr, "ERROR: replay expected message %u\n", i);
+			total_errors++;
+		}
+	if (cbj_pop(&j, &msg, sizeof(msg)) != -1)
+	{
+		fprintf(stderr, "ERROR: message %u replayed past the unpublished slot\n", msg.seq);
+		total_errors++;
+	}
+	// The rebuilt ring keeps working across a full lap
+	for (uint32_t i = 0; i < 2 * JOURNAL_CAPACITY; ++i)
+		if (journal_push(cbj_ring(&j), i, 1) != 0 || cbj_pop(&j, &msg, sizeof(msg)) != 0 || msg.seq != i)
+			total_errors++;
+	if (cbj_flush(&j, 0) != 0 || cbj_flush(&j, 1) != 0)
+		total_errors++;
+
+	if (total_errors == 0)
+		printf("OK: uncommitted messages replayed in order\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbj_close(&j);
+	cbj_unlink(path);
+	return (total_errors);
+}
+
+/* -- Growable: the consumer stalls periodically so the producer has to
+   chain larger segments, then keeps up so they shrink back. -- */
+
+static void *grow_producer(void *arg)
+{
+	CircularGrowBuffer *g = (CircularGrowBuffer *)arg;
+
+	for (uint32_t i = 0; i < MSG_COUNT; ++i)
+	{
+		Message msg = { .seq = i, .value = (uint64_t)i * 31 };
+		while (cbg_push(g, &msg, sizeof(msg)) != 0)
+			; /* spin: only when GROW_MAX is full */
+	}
+	return (NULL);
+}
+
+static void *grow_consumer(void *arg)
+{
+	CircularGrowBuffer	*g = (CircularGrowBuffer *)arg;
+	uint32_t			errors = 0;
+
+	for (uint32_t i = 0; i < MSG_COUNT; ++i)
+	{
+		Message msg;
+		if (i % GROW_BURST == 0 && i < MSG_COUNT / 2)
+		{
+			struct timespec stall = { 0, 200000 };
+			nanosleep(&stall, NULL);
+		}
+		while (cbg_pop(g, &msg, sizeof(msg)) != 0)
+			; /* spin until data available */
+		if ((msg.seq != i || msg.value != (uint64_t)i * 31) && errors++ < 10)
+			fprintf(stderr, "ERROR: growable got seq %u, expected %u\n", msg.seq, i);
+	}
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_growable(Allocator alloc)
+{
+	CircularGrowBuffer	g;
+	CbGrowConfig		cfg = {
+		.capacity = GROW_CAPACITY,
+		.max_capacity = GROW_MAX,
+		.slot_size = sizeof(Message),
+		.shrink_after = 4 * GROW_BURST,
+	};
+	pthread_t			prod_thread;
+	pthread_t			cons_thread;
+	void				*ret;
+
+	if (cbg_init(&g, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cbg_init failed\n");
+		return (1);
+	}
+
+	printf("Mode:          SPSC growable, %d to %d slots\n", GROW_CAPACITY, GROW_MAX);
+	pthread_create(&cons_thread, NULL, grow_consumer, &g);
+	pthread_create(&prod_thread, NULL, grow_producer, &g);
+	pthread_join(prod_thread, NULL);
+	pthread_join(cons_thread, &ret);
+
+	uint32_t total_errors = (uint32_t)(uintptr_t)ret;
+	printf("Segments:      %u grown, %u shrunk, %u live\n",
+		g.grows, g.shrinks, atomic_load(&g.segments));
+	if (g.grows == 0)
+	{
+		fprintf(stderr, "ERROR: growable ring never grew\n");
+		total_errors++;
+	}
+
+	if (total_errors == 0)
+		printf("OK: all messages received in order\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbg_free(&g);
+	return (total_errors);
+}
+
+/* -- Typed rings: fixed Message type and capacity, static storage. -- */
+
+CIRCBUF_DEFINE(TypedSpsc, Message, CAPACITY)
+CIRCBUF_DEFINE_MPMC(TypedMpmc, Message, CAPACITY)
+
+static TypedSpsc	typed_spsc;
+static TypedMpmc	typed_mpmc;
+
+typedef struct {
+	int				mpmc;
+	uint32_t		start_seq;
+	uint32_t		count;
+	ConsArgs		check;
+} TypedArgs;
+
+static void *typed_producer(void *arg)
+{
+	TypedArgs	*args = (TypedArgs *)arg;
+	Message		batch[BULK_COUNT];
+
+	for (uint32_t i = 0; i < args->count; )
+	{
+		uint32_t seq = args->start_seq + i;
+
+		if (args->mpmc)
+		{
+			Message msg = { .seq = seq, .value = (uint64_t)seq * 31337 };
+			while (TypedMpmc_push(&typed_mpmc, &msg) != 0)
+				; /* spin until slot available */
+			++i;
+			continue;
+		}
+		uint32_t want = args->count - i < BULK_COUNT ? args->count - i : BULK_COUNT;
+		for (uint32_t j = 0; j < want; ++j)
+			batch[j] = (Message){ .seq = seq + j, .value = (uint64_t)(seq + j) * 31337 };
+		for (uint32_t done = 0; done < want; )
+			done += TypedSpsc_push_n(&typed_spsc, batch + done, want - done);
+		i += want;
+	}
+	return (NULL);
+}
+
+static void *typed_consumer(void *arg)
+{
+	TypedArgs	*args = (TypedArgs *)arg;
+	uint32_t	errors = 0;
+	Message		msg;
+
+	for (uint32_t i = 0; i < args->count; ++i)
+	{
+		if (args->mpmc)
+		{
+			while (TypedMpmc_pop(&typed_mpmc, &msg) != 0)
+				; /* spin until data available */
+		}
+		else
+		{
+			while (TypedSpsc_pop(&typed_spsc, &msg) != 0)
+				; /* spin until data available */
+			if (msg.seq != i && errors++ < 10)
+				fprintf(stderr, "ERROR: typed ring got seq %u, expected %u\n", msg.seq, i);
+		}
+		errors += check_message(&args->check, &msg);
+	}
+	return ((void *)(uintptr_t)errors);
+}
+
+static uint32_t run_typed(int mpmc, _Atomic uint8_t *received_tracker)
+{
+	int			threads = mpmc ? MAX_THREADS : 1;
+	pthread_t	prod_threads[MAX_THREADS];
+	pthread_t	cons_threads[MAX_THREADS];
+	TypedArgs	prod_args[MAX_THREADS];
+	TypedArgs	cons_args[MAX_THREADS];
+	uint32_t	per_thread = MSG_COUNT / threads;
+
+	if (mpmc)
+		TypedMpmc_init(&typed_mpmc);
+	else
+		TypedSpsc_init(&typed_spsc);
+	memset((void *)received_tracker, 0, MSG_COUNT * sizeof(_Atomic uint8_t));
+
+	printf("Mode:          %s typed, capacity %d, %zu-byte slots\n", mpmc ? "MPMC" : "SPSC", CAPACITY,
+		mpmc ? sizeof(typed_mpmc.slots[0]) : sizeof(typed_spsc.slots[0]));
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < threads; ++i)
+	{
+		cons_args[i] = (TypedArgs){ .mpmc = mpmc, .count = per_thread,
+			.check = { .received_tracker = received_tracker } };
+		pthread_create(&cons_threads[i], NULL, typed_consumer, &cons_args[i]);
+	}
+	for (int i = 0; i < threads; ++i)
+	{
+		prod_args[i] = (TypedArgs){ .mpmc = mpmc, .start_seq = i * per_thread, .count = per_thread };
+		pthread_create(&prod_threads[i], NULL, typed_producer, &prod_args[i]);
+	}
+
+	uint32_t total_errors = 0;
+	for (int i = 0; i < threads; ++i)
+		pthread_join(prod_threads[i], NULL);
+	for (int i = 0; i < threads; ++i)
+	{
+		void *ret;
+		pthread_join(cons_threads[i], &ret);
+		total_errors += (uint32_t)(uintptr_t)ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (uint32_t i = 0; i < MSG_COUNT && total_errors <= 10; ++i)
+	{
+		if (atomic_load_explicit(&received_tracker[i], memory_order_relaxed) != 1)
+		{
+			if (total_errors == 0)
+				fprintf(stderr, "ERROR: Missing message seq %u\n", i);
+			total_errors++;
+		}
+	}
+
+	double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("Time:		%.3f s\n", elapsed);
+	printf("Throughput:	%.2f M msg/s\n", MSG_COUNT / elapsed / 1e6);
+
+	if (total_errors == 0)
+		printf("OK: all messages received correctly\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+	return (total_errors);
+}
+
+/* -- Priority lanes: one producer per lane, one consumer that checks
+   each lane stays in order. A single-threaded pass first checks the
+   weighted drain order. -- */
+
+static const uint32_t lane_weights[MAX_THREADS] = { 0, 8, 4, 1 };
+
+typedef struct {
+	CircularLaneBuffer	*l;
+	uint32_t			lane;
+	uint32_t			start_seq;
+	uint32_t			count;
+} LaneArgs;
+
+static void *lane_producer(void *arg)
+{
+	LaneArgs *args = (LaneArgs *)arg;
+
+	for (uint32_t i = 0; i < args->count; ++i)
+	{
+		uint32_t seq = args->start_seq + i;
+		Message msg = { .seq = seq, .value = (uint64_t)seq * 31337 };
+		while (cbl_push(args->l, args->lane, &msg, sizeof(msg)) != 0)
+			; /* spin until slot available */
+	}
+	return (NULL);
+}
+
+static uint32_t check_lane_order(CircularLaneBuffer *l)
+{
+	// Lane 1 (weight 8) and lane 2 (weight 4) take turns once lane 0 (strict) is drained
+	static const uint32_t	expect[][2] = { { 0, 3 }, { 1, 8 }, { 2, 4 }, { 1, 8 }, { 2, 4 }, { 1, 4 } };
+	Message					msg = { 0 };
+	uint32_t				errors = 0;
+
+	for (uint32_t i = 0; i < 20; ++i)
+		cbl_push(l, 1, &msg, sizeof(msg));
+	for (uint32_t i = 0; i < 8; ++i)
+		cbl_push(l, 2, &msg, sizeof(msg));
+	for (uint32_t i = 0; i < 3; ++i)
+		cbl_push(l, 0, &msg, sizeof(msg));
+	for (size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); ++i)
+	{
+		uint32_t	lane = UINT32_MAX;	// Left alone when every lane is empty
+		cb_seq_t	pos;
+		uint32_t	n = cbl_pop_claim(l, 16, &lane, &pos);
+
+		if (lane != expect[i][0] || n != expect[i][1])
+		{
+			fprintf(stderr, "ERROR: lane drain step %zu took %u from lane %u, expected %u from lane %u\n",
+				i, n, lane, expect[i][1], expect[i][0]);
+			errors++;
+		}
+		if (n)
+			cbl_pop_release(l, lane, pos, n);
+	}
+	return (errors + (cbl_pop(l, &msg, sizeof(msg)) != -1));
+}
+
+static uint32_t run_lanes(Allocator alloc, _Atomic uint8_t *received_tracker)
+{
+	CircularLaneBuffer	l;
+	CbLaneConfig		cfg = {
+		.lanes = MAX_THREADS,
+		.capacity = LANE_CAPACITY,
+		.slot_size = sizeof(Message),
+		.weights = lane_weights,
+	};
+	pthread_t			prod_threads[MAX_THREADS];
+	LaneArgs			prod_args[MAX_THREADS];
+	uint32_t			next_seq[MAX_THREADS];
+	ConsArgs			check = { .received_tracker = received_tracker };
+	uint32_t			msg_per_prod = MSG_COUNT / MAX_THREADS;
+
+	if (cbl_init(&l, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cbl_init failed\n");
+		return (1);
+	}
+	memset((void *)received_tracker, 0, MSG_COUNT * sizeof(_Atomic uint8_t));
+
+	printf("Mode:          priority lanes, %d lanes, weights 0/8/4/1\n", MAX_THREADS);
+	uint32_t total_errors = check_lane_order(&l);
+	for (int i = 0; i < MAX_THREADS; ++i)
+	{
+		next_seq[i] = i * msg_per_prod;
+		prod_args[i] = (LaneArgs){ .l = &l, .lane = i, .start_seq = i * msg_per_prod, .count = msg_per_prod };
+		pthread_create(&prod_threads[i], NULL, lane_producer, &prod_args[i]);
+	}
+	for (uint32_t done = 0; done < MSG_COUNT; )
+	{
+		uint32_t	lane;
+		cb_seq_t	pos;
+		uint32_t	n = cbl_pop_claim(&l, BATCH_SIZE, &lane, &pos);
+
+		for (uint32_t j = 0; j < n; ++j)
+		{
+			const Message *m = cb_slot_data(cbl_lane(&l, lane), pos + j);
+			if (m->seq != next_seq[lane]++)
+			{
+				if (total_errors < 10)
+					fprintf(stderr, "ERROR: lane %u out of order at seq %u\n", lane, m->seq);
+				total_errors++;
+			}
+			total_errors += check_message(&check, m);
+		}
+		if (n)
+			cbl_pop_release(&l, lane, pos, n);
+		done += n;
+	}
+	for (int i = 0; i < MAX_THREADS; ++i)
+		pthread_join(prod_threads[i], NULL);
+
+	if (total_errors == 0)
+		printf("OK: all messages received correctly\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbl_free(&l);
+	return (total_errors);
+}
+
+/* -- Lane handoff: one producer trickles messages into a lane that the
+   consumer keeps draining, so the consumer clears the lane's bit over and
+   over while the producer publishes. A message stranded behind a clear
+   bit shows as an empty poll after the producer is done. -- */
+
+typedef struct {
+	CircularLaneBuffer	*l;
+	_Atomic int			done;
+} LaneHandoffArgs;
+
+static void *lane_handoff_producer(void *arg)
+{
+	LaneHandoffArgs *args = (LaneHandoffArgs *)arg;
+
+	for (uint32_t i = 0; i < LANE_HANDOFF; ++i)
+	{
+		Message msg = { .seq = i, .value = (uint64_t)i * 31337 };
+		while (cbl_push(args->l, 1, &msg, sizeof(msg)) != 0)
+			; /* spin until slot available */
+		sched_yield(); // Let the consumer find the lane empty
+	}
+	atomic_store_explicit(&args->done, 1, memory_order_release);
+	return (NULL);
+}
+
+static uint32_t run_lanes_handoff(Allocator alloc)
+{
+	CircularLaneBuffer	l;
+	CbLaneConfig		cfg = { .lanes = 2, .capacity = LANE_CAPACITY, .slot_size = sizeof(Message) };
+	LaneHandoffArgs		args = { .l = &l };
+	pthread_t			prod_thread;
+	uint32_t			received = 0;
+	uint32_t			clears = 0;
+	uint32_t			total_errors = 0;
+
+	if (cbl_init(&l, alloc, &cfg) != 0)
+	{
+		fprintf(stderr, "cbl_init failed\n");
+		return (1);
+	}
+	atomic_init(&args.done, 0);
+
+	printf("Mode:          priority lanes, consumer clearing a lane's bit under its producer\n");
+	pthread_create(&prod_thread, NULL, lane_handoff_producer, &args);
+	while (received < LANE_HANDOFF)
+	{
+		Message	msg;
+		int		done = atomic_load_explicit(&args.done, memory_order_acquire);
+		int		was_set = (atomic_load_explicit(&l.occupied, memory_order_relaxed) & 2) != 0;
+		int		lane = cbl_pop(&l, &msg, sizeof(msg));
+
+		if (lane < 0)
+		{
+			clears += was_set; // Found the lane empty with its bit set: cleared it
+			if (done)
+			{
+				// Everything is published and visible: an empty poll now is a lost wakeup
+				fprintf(stderr, "ERROR: %u messages stranded after %u\n",
+					cb_size_approx(cbl_lane(&l, 1)), received);
+				total_errors++;
+				break;
+			}
+			continue;
+		}
+		if ((lane != 1 || msg.seq != received || msg.value != (uint64_t)received * 31337) && total_errors++ < 10)
+			fprintf(stderr, "ERROR: handoff message %u arrived as seq %u on lane %d\n", received, msg.seq, lane);
+		received++;
+	}
+	pthread_join(prod_thread, NULL);
+	printf("Messages:      %d, lane bit cleared %u times\n", LANE_HANDOFF, clears);
+	if (clears == 0)
+	{
+		fprintf(stderr, "ERROR: the consumer never cleared the lane's bit\n");
+		total_errors++;
+	}
+
+	if (total_errors == 0)
+		printf("OK: no message stranded behind a cleared bit\n\n");
+	else
+		printf("FAILED: %u errors\n\n", total_errors);
+
+	cbl_free(&l);
+	return (total_errors);
+}
+
+int main(void)
+{
+	Arena			arena = arena_init(PROT_READ | PROT_WRITE);
+	uint32_t		total_errors = 0;
+
+	_Atomic uint8_t *received_tracker = arena_alloc(&arena, MSG_COUNT * sizeof(_Atomic uint8_t));
+	if (!received_tracker)
+	{
+		fprintf(stderr, "failed to allocate tracker\n");
+		arena_free(&arena);
+		return (1);
+	}
+
+	double throughput[sizeof(modes) / sizeof(modes[0])] = { 0 };
+
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+		total_errors += run_mode(&arena, m, received_tracker, &throughput[m]);
+	printf("SPSC cached cursors: %.2f M msg/s, slot seq baseline: %.2f M msg/s (%.2fx)\n\n",
+		throughput[MODE_SPSC], throughput[MODE_SPSC_SEQ], throughput[MODE_SPSC] / throughput[MODE_SPSC_SEQ]);
+	total_errors += run_layout_index(malloc_allocator());
+	total_errors += run_mmap_alloc();
+	total_errors += run_watermarks(arena_allocator(&arena));
+	for (uint32_t l = CB_LAYOUT_PACKED; l <= CB_LAYOUT_SWIZZLED; ++l)
+	{
+		total_errors += run_bulk(arena_allocator(&arena), (CbLayout)l, 0, 0);
+		total_errors += run_bulk(arena_allocator(&arena), (CbLayout)l, CB_BULK_STREAM, 0);
+	}
+	total_errors += run_bulk(mirror_allocator(), CB_LAYOUT_PACKED, 0, CB_FLAG_MIRRORED);
+	total_errors += run_sharded(arena_allocator(&arena), 0, received_tracker);
+	total_errors += run_sharded(arena_allocator(&arena), CB_SHARD_FIFO, received_tracker);
+	total_errors += run_broadcast(arena_allocator(&arena));
+	total_errors += run_lanes(arena_allocator(&arena), received_tracker);
+	total_errors += run_lanes_handoff(arena_allocator(&arena));
+	total_errors += run_typed(0, received_tracker);
+	total_errors += run_typed(1, received_tracker);
+	total_errors += run_growable(malloc_allocator());
+	total_errors += run_overwrite(arena_allocator(&arena));
+	total_errors += run_shm();
+	total_errors += run_journal();
+	total_errors += run_bytes(arena_allocator(&arena), 0);
+	total_errors += run_bytes(mirror_allocator(), CB_FLAG_MIRRORED);
+	total_errors += run_io_datagrams(arena_allocator(&arena));
+	total_errors += run_io_stream(arena_allocator(&arena));
+	total_errors += run_uring(malloc_allocator(), 0);
+	total_errors += run_uring(malloc_allocator(), URING_WARMUP);
+	total_errors += run_uring_pipe(malloc_allocator());
+
 	arena_free(&arena);
 	return (total_errors != 0);
 }
@@ -0,0 +1,205 @@
+#ifndef CIRCBUF_TYPED_H
+# define CIRCBUF_TYPED_H
+
+#include "circbuf.h"
+
+/* -- Typed rings --
+   CIRCBUF_DEFINE(name, T, CAPACITY) emits a ring type `name` holding
+   CAPACITY values of type T (a power of two) in the struct itself, plus
+   static inline functions prefixed name_. Element size, stride and mask
+   are compile-time constants and values move by assignment, so a push or
+   pop compiles down to a few instructions and bulk copies to a loop the
+   compiler can vectorise. No allocator: put the ring in static storage,
+   on the heap, or inside another struct (aligned to a cache line).
+
+   CIRCBUF_DEFINE is SPSC and uses the cached-cursor scheme of the
+   runtime SPSC path; a zero-initialised ring (e.g. a static one) is
+   ready to use. CIRCBUF_DEFINE_MPMC is the seq protocol for any number
+   of producers and consumers and needs name_init before use.
+
+     CIRCBUF_DEFINE(OrderQueue, Order, 1024)
+     static OrderQueue q;
+     OrderQueue_push(&q, &order);	// 0, or -1 when full
+
+   Functions (both kinds):
+     void		name_init(name *q)
+     int		name_push(name *q, const T *value)	// 0, -1 when full
+     int		name_pop(name *q, T *out)			// 0, -1 when empty
+     uint32_t	name_size_approx(name *q)
+   SPSC only, copying up to count values in one publish/release:
+     uint32_t	name_push_n(name *q, const T *src, uint32_t count)
+     uint32_t	name_pop_n(name *q, T *dst, uint32_t count) */
+
+# define CIRCBUF_TYPED_CHECK(name, CAPACITY) \
+	_Static_assert((CAPACITY) >= 2 && ((CAPACITY) & ((CAPACITY) - 1)) == 0, \
+		#name ": capacity must be a power of two"); \
+	_Static_assert((cb_seq_t)(CAPACITY) == (CAPACITY), #name ": capacity does not fit cb_seq_t")
+
+# define CIRCBUF_DEFINE(name, T, CAPACITY) \
+	CIRCBUF_TYPED_CHECK(name, CAPACITY); \
+	typedef struct { \
+		_Alignas(64) _Atomic cb_seq_t	head; \
+		cb_seq_t						tail_cache;	/* producer-local */ \
+		_Alignas(64) _Atomic cb_seq_t	tail; \
+		cb_seq_t						head_cache;	/* consumer-local */ \
+		_Alignas(64) T					slots[CAPACITY]; \
+	} name; \
+	\
+	static inline void	name##_init(name *q) \
+	{ \
+		atomic_init(&q->head, 0); \
+		atomic_init(&q->tail, 0); \
+		q->tail_cache = 0; \
+		q->head_cache = 0; \
+	} \
+	\
+	/* Free slots from the producer's view, reloading tail only when the \
+	   cached copy says fewer than want. */ \
+	static inline uint32_t	name##_room(name *q, cb_seq_t pos, uint32_t want) \
+	{ \
+		uint32_t room = (uint32_t)((CAPACITY) - (pos - q->tail_cache)); \
+		if (room < want) \
+		{ \
+			q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire); \
+			room = (uint32_t)((CAPACITY) - (pos - q->tail_cache)); \
+		} \
+		return (room); \
+	} \
+	\
+	static inline uint32_t	name##_ready(name *q, cb_seq_t pos, uint32_t want) \
+	{ \
+		uint32_t ready = (uint32_t)(q->head_cache - pos); \
+		if (ready < want) \
+		{ \
+			q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire); \
+			ready = (uint32_t)(q->head_cache - pos); \
+		} \
+		return (ready); \
+	} \
+	\
+	static inline int	name##_push(name *q, const T *value) \
+	{ \
+		cb_seq_t pos = atomic_load_explicit(&q->head, memory_order_relaxed); \
+		if (name##_room(q, pos, 1) == 0) \
+			return (-1); /* Full */ \
+		q->slots[pos & ((CAPACITY) - 1)] = *value; \
+		atomic_store_explicit(&q->head, pos + 1, memory_order_release); \
+		return (0); \
+	} \
+	\
+	static inline int	name##_pop(name *q, T *out) \
+	{ \
+		cb_seq_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed); \
+		if (name##_ready(q, pos, 1) == 0) \
+			return (-1); /* Empty */ \
+		*out = q->slots[pos & ((CAPACITY) - 1)]; \
+		atomic_store_explicit(&q->tail, pos + 1, memory_order_release); \
+		return (0); \
+	} \
+	\
+	static inline uint32_t	name##_push_n(name *q, const T *src, uint32_t count) \
+	{ \
+		cb_seq_t pos = atomic_load_explicit(&q->head, memory_order_relaxed); \
+		uint32_t room = name##_room(q, pos, count); \
+		uint32_t n = count < room ? count : room; \
+		for (uint32_t i = 0; i < n; ++i) \
+			q->slots[(pos + i) & ((CAPACITY) - 1)] = src[i]; \
+		if (n) \
+			atomic_store_explicit(&q->head, pos + n, memory_order_release); \
+		return (n); \
+	} \
+	\
+	static inline uint32_t	name##_pop_n(name *q, T *dst, uint32_t count) \
+	{ \
+		cb_seq_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed); \
+		uint32_t ready = name##_ready(q, pos, count); \
+		uint32_t n = count < ready ? count : ready; \
+		for (uint32_t i = 0; i < n; ++i) \
+			dst[i] = q->slots[(pos + i) & ((CAPACITY) - 1)]; \
+		if (n) \
+			atomic_store_explicit(&q->tail, pos + n, memory_order_release); \
+		return (n); \
+	} \
+	\
+	static inline uint32_t	name##_size_approx(name *q) \
+	{ \
+		cb_seq_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed); \
+		return ((uint32_t)(atomic_load_explicit(&q->head, memory_order_relaxed) - tail)); \
+	}
+
+# define CIRCBUF_DEFINE_MPMC(name, T, CAPACITY) \
+	CIRCBUF_TYPED_CHECK(name, CAPACITY); \
+	typedef struct { \
+		_Atomic cb_seq_t	seq; \
+		T					value; \
+	} name##_slot; \
+	\
+	typedef struct { \
+		_Alignas(64) _Atomic cb_seq_t	head; \
+		_Alignas(64) _Atomic cb_seq_t	tail; \
+		_Alignas(64) name##_slot		slots[CAPACITY]; \
+	} name; \
+	\
+	static inline void	name##_init(name *q) \
+	{ \
+		for (uint32_t i = 0; i < (CAPACITY); ++i) \
+			atomic_init(&q->slots[i].seq, i); \
+		atomic_init(&q->head, 0); \
+		atomic_init(&q->tail, 0); \
+	} \
+	\
+	/* Claims one position on index: offset 0 for a free slot (push), 1 \
+	   for a published one (pop). Returns NULL when full/empty. */ \
+	static inline name##_slot	*name##_claim(name *q, _Atomic cb_seq_t *index, cb_seq_t offset, cb_seq_t *out_pos) \
+	{ \
+		cb_seq_t pos = atomic_load_explicit(index, memory_order_relaxed); \
+		for (;;) \
+		{ \
+			name##_slot	*slot = &q->slots[pos & ((CAPACITY) - 1)]; \
+			cb_sdiff_t	diff = (cb_sdiff_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + offset)); \
+			if (diff == 0) \
+			{ \
+				if (atomic_compare_exchange_weak_explicit(index, &pos, pos + 1, \
+						memory_order_relaxed, memory_order_relaxed)) \
+				{ \
+					*out_pos = pos; \
+					return (slot); \
+				} \
+			} \
+			else if (diff < 0) \
+				return (NULL); /* Full/Empty */ \
+			else \
+				pos = atomic_load_explicit(index, memory_order_relaxed); \
+		} \
+	} \
+	\
+	static inline int	name##_push(name *q, const T *value) \
+	{ \
+		cb_seq_t	pos; \
+		name##_slot	*slot = name##_claim(q, &q->head, 0, &pos); \
+		if (!slot) \
+			return (-1); \
+		slot->value = *value; \
+		atomic_store_explicit(&slot->seq, pos + 1, memory_order_release); \
+		return (0); \
+	} \
+	\
+	static inline int	name##_pop(name *q, T *out) \
+	{ \
+		cb_seq_t	pos; \
+		name##_slot	*slot = name##_claim(q, &q->tail, 1, &pos); \
+		if (!slot) \
+			return (-1); \
+		*out = slot->value; \
+		atomic_store_explicit(&slot->seq, pos + (CAPACITY), memory_order_release); \
+		return (0); \
+	} \
+	\
+	static inline uint32_t	name##_size_approx(name *q) \
+	{ \
+		cb_seq_t	tail = atomic_load_explicit(&q->tail, memory_order_relaxed); \
+		cb_sdiff_t	size = (cb_sdiff_t)(atomic_load_explicit(&q->head, memory_order_relaxed) - tail); \
+		return (size < 0 ? 0 : size > (CAPACITY) ? (CAPACITY) : (uint32_t)size); \
+	}
+
+#endif // CIRCBUF_TYPED_H
@@ -0,0 +1,323 @@
+#ifndef CIRCBUF_URING_H
+# define CIRCBUF_URING_H
+
+#include "circbuf.h"
+#include "circbuf_io.h"
+
+#ifdef __linux__
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <unistd.h>
+
+/* -- io_uring adapter --
+   Registers the slot array of a CircularBuffer as io_uring fixed buffer
+   0, so the kernel reads into and writes from slots without per-request
+   page pinning, and drives one direction of the ring:
+
+     reader  cb_uring_read claims free slots and queues one READ_FIXED per
+             slot at the fd's current position, hard-linked so they run
+             one after another; cb_uring_reap publishes them as their CQEs
+             arrive. A new batch waits until the last one is published,
+             so stream order holds on sockets, pipes and files alike.
+             The adapter must be the only producer (SPSC/SPMC).
+     writer  cb_uring_write claims ready slots and queues one WRITE_FIXED
+             per slot at consecutive file offsets; cb_uring_reap releases
+             them once written. The adapter must be the only consumer
+             (SPSC/MPSC).
+
+   Slots are framed as CbDatagram (circbuf_io.h). CQEs may complete out of
+   order; slots are published/released strictly in claim order, as the
+   prefix of completed positions. A failed read publishes an empty
+   datagram and a failed or short write still releases its slot; both
+   leave the error in last_error. Requests io_uring_enter did not take
+   stay queued and go out with the next read, write or reap. Raw syscalls
+   only, no liburing; needs _GNU_SOURCE like circbuf_io.h. */
+
+typedef struct {
+	int					ring_fd;
+	uint32_t			sq_entries;
+	_Atomic uint32_t	*sq_head;
+	_Atomic uint32_t	*sq_tail;
+	uint32_t			sq_mask;
+	uint32_t			*sq_array;
+	struct io_uring_sqe	*sqes;
+	_Atomic uint32_t	*cq_head;
+	_Atomic uint32_t	*cq_tail;
+	uint32_t			cq_mask;
+	struct io_uring_cqe	*cqes;
+	void				*sq_ring;
+	void				*cq_ring;
+	size_t				sq_ring_size;
+	size_t				cq_ring_size;
+	size_t				sqes_size;
+
+	CircularBuffer		*cb;
+	Allocator			alloc;
+	uint8_t				*done;		// per slot: CQE seen, not yet published/released
+	cb_seq_t			next;		// oldest position in flight, reseeded from the claim when idle
+	cb_seq_t			end;		// one past the newest position in flight
+	int					writer;		// -1 until the first read/write picks a direction
+	uint64_t			file_off;	// writer: offset of the next write, set before the first
+	uint32_t			unsubmitted;	// queued SQEs io_uring_enter has not consumed yet
+	int					last_error;	// last negative CQE result, 0 if none
+} CbUring;
+
+static inline int cb_uring_enter(CbUring *u, uint32_t submit, uint32_t wait)
+{
+	int r = (int)syscall(__NR_io_uring_enter, u->ring_fd, submit, wait,
+		wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	return (r < 0 ? -errno : r);
+}
+
+/* Submits every queued SQE, including any a previous short submit left
+   behind. Returns io_uring_enter's result. */
+static inline int cb_uring_submit(CbUring *u, uint32_t wait)
+{
+	int r = cb_uring_enter(u, u->unsubmitted, wait);
+
+	if (r > 0)
+		u->unsubmitted -= (uint32_t)r;
+	return (r);
+}
+
+static inline void	cb_uring_free(CbUring *u)
+{
+	if (!u || u->ring_fd < 0)
+		return;
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_ring && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->done && u->alloc.free)
+		u->alloc.free(u->alloc.ctx, u->done);
+	close(u->ring_fd);
+	u->ring_fd = -1;
+}
+
+/* entries bounds the slots in flight; alloc provides the completion map. */
+static inline int	cb_uring_init(CbUring *u, CircularBuffer *cb, Allocator alloc, uint32_t entries)
+{
+	struct io_uring_params	p;
+
+	assert(u != NULL && "u is NULL");
+	assert(cb != NULL && cb->slots_off != 0 && "cb is not initialised");
+	assert(cb->slot_size > offsetof(CbDatagram, data) && "slot_size too small for a CbDatagram");
+	if (!u || !cb || !cb->slots_off || !alloc.alloc || cb->slot_size <= offsetof(CbDatagram, data))
+		return (-EINVAL);
+
+	memset(u, 0, sizeof(*u));
+	memset(&p, 0, sizeof(p));
+	u->cb = cb;
+	u->alloc = alloc;
+	u->writer = -1;
+	u->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (u->ring_fd < 0)
+		return (-errno);
+
+	u->sq_entries = p.sq_entries;
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (u->cq_ring_size > u->sq_ring_size)
+			u->sq_ring_size = u->cq_ring_size;
+		u->cq_ring_size = u->sq_ring_size;
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		u->ring_fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+		u->sq_ring = NULL;
+	u->cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? u->sq_ring
+		: mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			u->ring_fd, IORING_OFF_CQ_RING);
+	if (u->cq_ring == MAP_FAILED)
+		u->cq_ring = NULL;
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		u->ring_fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		u->sqes = NULL;
+	u->done = alloc.alloc(alloc.ctx, (size_t)cb->mask + 1, 0);
+	if (!u->sq_ring || !u->cq_ring || !u->sqes || !u->done)
+	{
+		cb_uring_free(u);
+		return (-ENOMEM);
+	}
+	memset(u->done, 0, (size_t)cb->mask + 1);
+
+	uint8_t *sq = (uint8_t *)u->sq_ring;
+	uint8_t *cq = (uint8_t *)u->cq_ring;
+	u->sq_head = (_Atomic uint32_t *)(sq + p.sq_off.head);
+	u->sq_tail = (_Atomic uint32_t *)(sq + p.sq_off.tail);
+	u->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	u->cq_head = (_Atomic uint32_t *)(cq + p.cq_off.head);
+	u->cq_tail = (_Atomic uint32_t *)(cq + p.cq_off.tail);
+	u->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	struct iovec iov = { .iov_base = cb_slots(cb), .iov_len = (size_t)(cb->mask + 1) * cb->stride };
+	if (syscall(__NR_io_uring_register, u->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+	{
+		int err = -errno;
+		cb_uring_free(u);
+		return (err);
+	}
+	return (0);
+}
+
+/* Queues one fixed-buffer request per slot of [pos, pos + count). Reads
+   are hard-linked: concurrent current-position reads on one fd do not
+   run in submission order, and a short read must not cancel the rest. */
+static inline void	cb_uring_queue(CbUring *u, int fd, uint8_t opcode, cb_seq_t pos, uint32_t count)
+{
+	uint32_t	tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+	uint32_t	cap = u->cb->slot_size - (uint32_t)offsetof(CbDatagram, data);
+
+	for (uint32_t i = 0; i < count; ++i, ++tail)
+	{
+		CbDatagram			*dg = (CbDatagram *)cb_slot_data(u->cb, pos + i);
+		uint32_t			idx = tail & u->sq_mask;
+		struct io_uring_sqe	*sqe = &u->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = opcode;
+		sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)dg->data;
+		sqe->buf_index = 0;
+		sqe->user_data = (uint64_t)(pos + i);
+		if (opcode == IORING_OP_READ_FIXED)
+		{
+			sqe->len = cap;
+			sqe->off = (uint64_t)-1; // Current position: sockets, pipes, devices
+			if (i + 1 < count)
+				sqe->flags = IOSQE_IO_HARDLINK;
+		}
+		else
+		{
+			sqe->len = dg->len;
+			sqe->off = u->file_off;
+			u->file_off += dg->len;
+		}
+		u->sq_array[idx] = idx;
+	}
+	atomic_store_explicit(u->sq_tail, tail, memory_order_release);
+}
+
+/* Room left for new requests: bounded by free SQ entries and by the
+   in-flight window, which is sized to the CQ too. */
+static inline uint32_t	cb_uring_room(CbUring *u, uint32_t max)
+{
+	uint32_t free_sq = u->sq_entries - (atomic_load_explicit(u->sq_tail, memory_order_relaxed)
+		- atomic_load_explicit(u->sq_head, memory_order_acquire));
+	uint32_t window = u->sq_entries - (uint32_t)(u->end - u->next);
+
+	if (max > free_sq)
+		max = free_sq;
+	return (max < window ? max : window);
+}
+
+/* Claims up to max free slots and submits a read into each, unless the
+   previous batch is still in flight. Returns the number queued, or -errno
+   (-ENOBUFS: ring full, window exhausted or a batch in flight); after an
+   io_uring_enter error the reads stay queued. */
+static inline int	cb_uring_read(CbUring *u, int fd, uint32_t max)
+{
+	assert(!(u->cb->mode & CB_MPSC) && "io_uring reader needs a single producer");
+	assert(u->writer != 1 && "this CbUring is a writer");
+	u->writer = 0;
+
+	cb_seq_t	pos;
+	uint32_t	room = u->next == u->end ? cb_uring_room(u, max) : 0; // One linked batch at a time
+	uint32_t	n = room ? cb_push_claim_n(u->cb, room, &pos) : 0;
+
+	if (n == 0)
+		return (-ENOBUFS);
+	if (u->next == u->end)
+		u->next = u->end = pos; // Idle: the ring may have moved on without the adapter
+	assert(pos == u->end && "slots claimed behind the adapter's back");
+	cb_uring_queue(u, fd, IORING_OP_READ_FIXED, pos, n);
+	u->end = pos + n;
+	u->unsubmitted += n;
+
+	int r = cb_uring_submit(u, 0);
+	return (r < 0 ? r : (int)n);
+}
+
+/* Claims up to max ready slots and submits a write of each record, back
+   to back from file_off. */
+static inline int	cb_uring_write(CbUring *u, int fd, uint32_t max)
+{
+	assert(!(u->cb->mode & CB_SPMC) && "io_uring writer needs a single consumer");
+	assert(u->writer != 0 && "this CbUring is a reader");
+	u->writer = 1;
+
+	cb_seq_t	pos;
+	uint32_t	room = cb_uring_room(u, max);
+	uint32_t	n = room ? cb_pop_claim_n(u->cb, room, &pos) : 0;
+
+	if (n == 0)
+		return (-ENOBUFS);
+	if (u->next == u->end)
+		u->next = u->end = pos; // Idle: the ring may have moved on without the adapter
+	assert(pos == u->end && "slots claimed behind the adapter's back");
+	cb_uring_queue(u, fd, IORING_OP_WRITE_FIXED, pos, n);
+	u->end = pos + n;
+	u->unsubmitted += n;
+
+	int r = cb_uring_submit(u, 0);
+	return (r < 0 ? r : (int)n);
+}
+
+/* Submits what is still queued, drains the CQ (waiting for at least
+   wait completions first) and publishes/releases the completed prefix.
+   Returns how many slots it moved, or -errno from io_uring_enter;
+   -EAGAIN and -EBUSY still drain, since completions free the room the
+   kernel was short of. */
+static inline int	cb_uring_reap(CbUring *u, uint32_t wait)
+{
+	if (wait || u->unsubmitted)
+	{
+		int r = cb_uring_submit(u, wait);
+		if (r < 0 && r != -EINTR && r != -EAGAIN && r != -EBUSY)
+			return (r);
+	}
+
+	uint32_t head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(u->cq_tail, memory_order_acquire);
+
+	for (; head != tail; ++head)
+	{
+		struct io_uring_cqe	*cqe = &u->cqes[head & u->cq_mask];
+		cb_seq_t			pos = (cb_seq_t)cqe->user_data;
+		CbDatagram			*dg = (CbDatagram *)cb_slot_data(u->cb, pos);
+
+		if (cqe->res < 0)
+			u->last_error = cqe->res;
+		if (!u->writer)
+			dg->len = cqe->res > 0 ? (uint32_t)cqe->res : 0;
+		else if (cqe->res >= 0 && (uint32_t)cqe->res < dg->len)
+			u->last_error = -EIO; // Short write
+		u->done[pos & u->cb->mask] = 1;
+	}
+	atomic_store_explicit(u->cq_head, head, memory_order_release);
+
+	cb_seq_t start = u->next;
+	while (u->next != u->end && u->done[u->next & u->cb->mask])
+		u->done[u->next++ & u->cb->mask] = 0;
+
+	uint32_t n = (uint32_t)(u->next - start);
+	if (n && !u->writer)
+		cb_push_publish_n(u->cb, start, n);
+	else if (n)
+		cb_pop_release_n(u->cb, start, n);
+	return ((int)n);
+}
+
+#endif // __linux__
+#endif // CIRCBUF_URING_H
@@ -0,0 +1,104 @@
+#ifndef MIRROR_ALLOCATOR_H
+# define MIRROR_ALLOCATOR_H
+
+#include "allocator.h"
+
+#ifdef __linux__
+# include <stdint.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+
+/* -- Mirror allocator --
+   Maps the same pages twice, back to back: ptr[i] and ptr[i + size] alias,
+   so a range that runs off the end stays contiguous. size must be a
+   multiple of the page size. A private header page in front of the
+   mapping remembers the size for free.
+
+   Needs _DEFAULT_SOURCE (MAP_ANONYMOUS, memfd via syscall(2)), which the
+   header leaves to the includer: define it (or _GNU_SOURCE) above the
+   first #include, or build with -D_DEFAULT_SOURCE. */
+
+# ifndef MAP_ANONYMOUS
+#  error "mirror_allocator.h needs _DEFAULT_SOURCE defined before any system header"
+# endif
+
+typedef struct {
+	size_t	size;
+} MirrorHeader;
+
+static inline void	*mirror_alloc(void *ctx, size_t size, size_t align)
+{
+	(void)ctx;
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	assert(size > 0 && size % page == 0 && "mirror size must be a multiple of the page size");
+	assert(align <= page && "mirror alignment is limited to the page size");
+	if (size == 0 || size % page != 0 || align > page)
+		return (NULL);
+
+	int fd = (int)syscall(SYS_memfd_create, "circbuf-mirror", 0);
+	if (fd < 0)
+		return (NULL);
+	if (ftruncate(fd, (off_t)size) != 0)
+	{
+		close(fd);
+		return (NULL);
+	}
+
+	uint8_t *base = mmap(NULL, page + 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		close(fd);
+		return (NULL);
+	}
+	uint8_t *data = base + page;
+	if (mmap(base, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED
+		|| mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+		|| mmap(data + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(base, page + 2 * size);
+		close(fd);
+		return (NULL);
+	}
+	close(fd); // The mappings keep the memory alive
+
+	((MirrorHeader *)base)->size = size;
+	return (data);
+}
+
+static inline void	*mirror_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size, size_t align)
+{
+	(void)ctx;
+	(void)ptr;
+	(void)old_size;
+	(void)new_size;
+	(void)align;
+	assert(0 && "mirror mappings cannot be resized");
+	return (NULL);
+}
+
+static inline void	mirror_free(void *ctx, void *ptr)
+{
+	(void)ctx;
+	if (!ptr)
+		return;
+
+	size_t	page = (size_t)sysconf(_SC_PAGESIZE);
+	uint8_t	*base = (uint8_t *)ptr - page;
+	munmap(base, page + 2 * ((MirrorHeader *)base)->size);
+}
+
+static inline Allocator	mirror_allocator(void)
+{
+	Allocator a;
+
+	a.alloc = mirror_alloc;
+	a.realloc = mirror_realloc;
+	a.free = mirror_free;
+	a.ctx = NULL;
+	return (a);
+}
+
+#endif // __linux__
+#endif // MIRROR_ALLOCATOR_H
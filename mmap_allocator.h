@@ -0,0 +1,172 @@
+#ifndef MMAP_ALLOCATOR_H
+# define MMAP_ALLOCATOR_H
+
+#include "allocator.h"
+
+#ifdef __linux__
+# include <stdint.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+
+/* -- Mmap allocator --
+   Page-backed allocations straight from mmap, for large slot arrays:
+     MMAP_ALLOC_HUGE      2 MB pages (MAP_HUGETLB, falling back to a
+                          2 MB-aligned mapping with MADV_HUGEPAGE)
+     MMAP_ALLOC_POPULATE  pre-fault every page at allocation time, after
+                          NUMA binding, so the hot path never first-touches
+   numa_node >= 0 binds the pages to that node with mbind(2), without
+   needing libnuma; nodes from MMAP_NUMA_NODES up are refused. Any
+   alignment up to the page size is honoured.
+
+   Needs _DEFAULT_SOURCE (MAP_ANONYMOUS, MAP_HUGETLB, madvise, syscall),
+   which the header leaves to the includer: define it (or _GNU_SOURCE)
+   above the first #include, or build with -D_DEFAULT_SOURCE. */
+
+# ifndef MAP_ANONYMOUS
+#  error "mmap_allocator.h needs _DEFAULT_SOURCE defined before any system header"
+# endif
+
+# define MMAP_ALLOC_HUGE		1u
+# define MMAP_ALLOC_POPULATE	2u
+
+# define MMAP_HUGE_PAGE_SIZE	(2u * 1024 * 1024)
+# define MMAP_NUMA_NODES		256	// nodes the mbind mask covers
+
+# ifndef MAP_HUGE_2MB
+#  define MAP_HUGE_2MB			(21 << 26)
+# endif
+# ifndef MPOL_BIND
+#  define MPOL_BIND				2
+# endif
+# ifndef MPOL_MF_MOVE
+#  define MPOL_MF_MOVE			(1 << 1)
+# endif
+
+typedef struct {
+	int			numa_node;	// -1 = no binding
+	uint32_t	flags;		// MMAP_ALLOC_*
+} MmapAllocatorConfig;
+
+/* Lives just below the returned pointer. */
+typedef struct {
+	void	*base;
+	size_t	length;
+} MmapHeader;
+
+static inline void	*mmap_map_aligned(size_t length, size_t align)
+{
+	uint8_t *raw = mmap(NULL, length + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return (NULL);
+
+	uint8_t *base = (uint8_t *)(((uintptr_t)raw + align - 1) & ~((uintptr_t)align - 1));
+	if (base > raw)
+		munmap(raw, (size_t)(base - raw));
+	if (base + length < raw + length + align)
+		munmap(base + length, (size_t)(raw + length + align - (base + length)));
+	return (base);
+}
+
+static inline void	*mmap_alloc(void *ctx, size_t size, size_t align)
+{
+	MmapAllocatorConfig	*cfg = (MmapAllocatorConfig *)ctx;
+	size_t				page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t				offset = sizeof(MmapHeader);
+
+	assert(cfg != NULL && "mmap allocator needs a config");
+	assert(align <= page && "mmap alignment is limited to the page size");
+	if (!cfg || align > page || cfg->numa_node >= MMAP_NUMA_NODES)
+		return (NULL); // Past the mbind mask, like a node mbind would refuse
+
+	if (align > offset)
+		offset = align;
+	offset = (offset + 63) & ~(size_t)63; // Keep the data line-aligned
+
+	size_t	length;
+	uint8_t	*base = NULL;
+
+	if (cfg->flags & MMAP_ALLOC_HUGE)
+	{
+		length = (size + offset + MMAP_HUGE_PAGE_SIZE - 1) & ~(size_t)(MMAP_HUGE_PAGE_SIZE - 1);
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			base = mmap_map_aligned(length, MMAP_HUGE_PAGE_SIZE);
+			if (base)
+				madvise(base, length, MADV_HUGEPAGE);
+		}
+	}
+	else
+	{
+		length = (size + offset + page - 1) & ~(page - 1);
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			base = NULL;
+	}
+	if (!base)
+		return (NULL);
+
+	if (cfg->numa_node >= 0)
+	{
+		size_t			bits = sizeof(unsigned long) * 8;
+		unsigned long	nodemask[MMAP_NUMA_NODES / (sizeof(unsigned long) * 8)] = { 0 };
+
+		nodemask[cfg->numa_node / bits] = 1ul << (cfg->numa_node % bits);
+		if (syscall(SYS_mbind, base, length, MPOL_BIND, nodemask,
+				sizeof(nodemask) * 8, MPOL_MF_MOVE) != 0)
+		{
+			munmap(base, length);
+			return (NULL);
+		}
+	}
+
+	if (cfg->flags & MMAP_ALLOC_POPULATE)
+	{
+		for (size_t off = 0; off < length; off += page)
+			((volatile uint8_t *)base)[off] = 0;
+	}
+
+	MmapHeader *hdr = (MmapHeader *)(base + offset) - 1;
+	hdr->base = base;
+	hdr->length = length;
+	return (base + offset);
+}
+
+static inline void	mmap_free(void *ctx, void *ptr)
+{
+	(void)ctx;
+	if (!ptr)
+		return;
+
+	MmapHeader *hdr = (MmapHeader *)ptr - 1;
+	munmap(hdr->base, hdr->length);
+}
+
+static inline void	*mmap_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size, size_t align)
+{
+	void *new_ptr = mmap_alloc(ctx, new_size, align);
+	if (!new_ptr)
+		return (NULL);
+	if (ptr)
+	{
+		memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+		mmap_free(ctx, ptr);
+	}
+	return (new_ptr);
+}
+
+static inline Allocator	mmap_allocator(MmapAllocatorConfig *cfg)
+{
+	Allocator a;
+
+	a.alloc = mmap_alloc;
+	a.realloc = mmap_realloc;
+	a.free = mmap_free;
+	a.ctx = cfg;
+	return (a);
+}
+
+#endif // __linux__
+#endif // MMAP_ALLOCATOR_H